@@ -0,0 +1,32 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+// 用户表的存取后端，UserVerify只通过它查询和新增用户。
+// 回调在哪个线程执行由实现决定：MySQL在SqlAsync的事件线程，
+// 内嵌存储在调用线程上同步执行(IsInline)
+class AuthBackend {
+public:
+  enum Status {
+    OK,
+    NOT_FOUND, // Lookup：用户不存在
+    EXISTS,    // Insert：用户名已被占用
+    ERROR,
+    BUSY, // 后端繁忙，没有执行
+  };
+  struct Result {
+    Status status = ERROR;
+    std::string password; // Lookup成功时为存储的密码
+  };
+  typedef std::function<void(const Result &)> Callback;
+
+  virtual ~AuthBackend() = default;
+
+  // 排队已满时返回false，不会调用done
+  virtual bool Lookup(const std::string &name, Callback done) = 0;
+  virtual bool Insert(const std::string &name, const std::string &pwd,
+                      Callback done) = 0;
+  // 为true时回调总在调用返回前执行，调用方不必转交其他线程
+  virtual bool IsInline() const = 0;
+};
@@ -0,0 +1,51 @@
+#include "sqlauth.h"
+
+namespace {
+
+// 用户名和密码作为参数绑定，不拼进SQL文本
+const char *const SELECT_USER =
+    "SELECT username, password FROM user WHERE username=? LIMIT 1";
+const char *const INSERT_USER = "INSERT INTO user(username, password) VALUES";
+
+} // namespace
+
+SqlAuth::SqlAuth()
+    : inserts_(INSERT_USER, 2, INSERT_BATCH, INSERT_IN_FLIGHT,
+               INSERT_PENDING) {}
+
+bool SqlAuth::Lookup(const std::string &name, Callback done) {
+  return SqlAsync::Instance()->Execute(
+      SELECT_USER, {name}, [done](const SqlResult &res) {
+        Result result;
+        if (res.busy) {
+          result.status = BUSY;
+        } else if (!res.ok) {
+          result.status = ERROR;
+        } else if (res.rows.empty()) {
+          result.status = NOT_FOUND;
+        } else {
+          LOG_DEBUG("MYSQL ROW: %s %s", res.rows[0][0].c_str(),
+                    res.rows[0][1].c_str());
+          result.status = OK;
+          result.password = res.rows[0][1];
+        }
+        done(result);
+      });
+}
+
+bool SqlAuth::Insert(const std::string &name, const std::string &pwd,
+                     Callback done) {
+  return inserts_.Add({name, pwd}, [done](const SqlResult &res) {
+    Result result;
+    if (res.ok) {
+      result.status = OK;
+    } else if (res.busy) {
+      result.status = BUSY;
+    } else if (res.err == ER_DUP_ENTRY) {
+      result.status = EXISTS;
+    } else {
+      result.status = ERROR;
+    }
+    done(result);
+  });
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "../pool/insertbatcher.h"
+#include "../pool/sqlasync.h"
+#include "authbackend.h"
+
+// 用户表在MySQL中：查询走SqlAsync，新增用户经InsertBatcher合并提交
+class SqlAuth : public AuthBackend {
+public:
+  SqlAuth();
+
+  bool Lookup(const std::string &name, Callback done) override;
+  bool Insert(const std::string &name, const std::string &pwd,
+              Callback done) override;
+  bool IsInline() const override { return false; }
+
+private:
+  // 注册的INSERT每批行数、同时执行的批数、排队的行数上限
+  static const size_t INSERT_BATCH = 64;
+  static const size_t INSERT_IN_FLIGHT = 2;
+  static const size_t INSERT_PENDING = 4096;
+
+  InsertBatcher inserts_;
+};
@@ -0,0 +1,197 @@
+#include "userstore.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <zlib.h>
+
+bool UserStore::Open(const std::string &path) {
+  assert(fd_ < 0);
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd_ < 0) {
+    LOG_ERROR("UserStore open %s error: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  fstat(fd_, &st);
+  size_t size = static_cast<size_t>(st.st_size);
+  bool fresh = size == 0;
+  if (!fresh && size < sizeof(MAGIC)) {
+    LOG_ERROR("UserStore %s: not a user store", path.c_str());
+    Close();
+    return false;
+  }
+  cap_ = std::max(size, INIT_SIZE);
+  if (cap_ != size && ftruncate(fd_, cap_) < 0) {
+    LOG_ERROR("UserStore %s resize error: %s", path.c_str(), strerror(errno));
+    Close();
+    return false;
+  }
+  void *addr = mmap(nullptr, cap_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (addr == MAP_FAILED) {
+    LOG_ERROR("UserStore %s mmap error: %s", path.c_str(), strerror(errno));
+    base_ = nullptr;
+    Close();
+    return false;
+  }
+  base_ = static_cast<char *>(addr);
+  if (fresh) {
+    memcpy(base_, MAGIC, sizeof(MAGIC));
+  } else if (memcmp(base_, MAGIC, sizeof(MAGIC)) != 0) {
+    LOG_ERROR("UserStore %s: not a user store", path.c_str());
+    Close();
+    return false;
+  }
+  size_t dropped = Recover_();
+  if (dropped) {
+    LOG_WARN("UserStore %s: dropped %zu bytes of incomplete records",
+             path.c_str(), dropped);
+  }
+  LOG_INFO("UserStore %s: %zu users, %zu bytes", path.c_str(), index_.size(),
+           tail_);
+  return true;
+}
+
+// 重放日志重建索引，返回被丢弃的字节数。
+// 掉电时页面不一定按顺序落盘，坏记录之后即使有完整的记录也不能信任，一并清零，
+// 免得之后追加的记录与残留内容拼在一起
+size_t UserStore::Recover_() {
+  size_t off = sizeof(MAGIC);
+  while (off + sizeof(Head) <= cap_) {
+    Head head;
+    memcpy(&head, base_ + off, sizeof(head));
+    if (head.nameLen == 0) {
+      break;
+    }
+    size_t size = RecordSize_(head);
+    if (off + size > cap_ ||
+        Crc_(head, base_ + off + sizeof(Head)) != head.crc) {
+      break;
+    }
+    index_.emplace(std::string(base_ + off + sizeof(Head), head.nameLen), off);
+    off += size;
+  }
+  tail_ = off;
+  size_t dirty = cap_;
+  while (dirty > tail_ && base_[dirty - 1] == 0) {
+    --dirty;
+  }
+  if (dirty > tail_) {
+    memset(base_ + tail_, 0, dirty - tail_);
+    return dirty - tail_;
+  }
+  return 0;
+}
+
+void UserStore::Close() {
+  std::unique_lock<std::shared_mutex> lock(mtx_);
+  if (base_) {
+    msync(base_, cap_, MS_SYNC);
+    munmap(base_, cap_);
+    base_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  cap_ = tail_ = 0;
+  index_.clear();
+}
+
+size_t UserStore::Size() {
+  std::shared_lock<std::shared_mutex> lock(mtx_);
+  return index_.size();
+}
+
+size_t UserStore::RecordSize_(const Head &head) {
+  size_t size = sizeof(Head) + head.nameLen + head.pwdLen;
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+uint32_t UserStore::Crc_(const Head &head, const char *data) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, reinterpret_cast<const Bytef *>(&head.nameLen),
+              sizeof(head.nameLen) + sizeof(head.pwdLen));
+  crc = crc32(crc, reinterpret_cast<const Bytef *>(data),
+              head.nameLen + head.pwdLen);
+  return static_cast<uint32_t>(crc);
+}
+
+// 调用方持有独占锁；文件按倍数增长，映射随之移动
+bool UserStore::Reserve_(size_t bytes) {
+  if (tail_ + bytes <= cap_) {
+    return true;
+  }
+  size_t cap = cap_;
+  while (tail_ + bytes > cap) {
+    cap *= 2;
+  }
+  if (ftruncate(fd_, cap) < 0) {
+    LOG_ERROR("UserStore resize error: %s", strerror(errno));
+    return false;
+  }
+  void *addr = mremap(base_, cap_, cap, MREMAP_MAYMOVE);
+  if (addr == MAP_FAILED) {
+    LOG_ERROR("UserStore mremap error: %s", strerror(errno));
+    return false;
+  }
+  base_ = static_cast<char *>(addr);
+  cap_ = cap;
+  return true;
+}
+
+bool UserStore::Lookup(const std::string &name, Callback done) {
+  Result result;
+  {
+    std::shared_lock<std::shared_mutex> lock(mtx_);
+    auto it = index_.find(name);
+    if (!base_) {
+      result.status = ERROR;
+    } else if (it == index_.end()) {
+      result.status = NOT_FOUND;
+    } else {
+      Head head;
+      memcpy(&head, base_ + it->second, sizeof(head));
+      result.status = OK;
+      result.password.assign(base_ + it->second + sizeof(Head) + head.nameLen,
+                             head.pwdLen);
+    }
+  }
+  done(result);
+  return true;
+}
+
+bool UserStore::Insert(const std::string &name, const std::string &pwd,
+                       Callback done) {
+  Result result;
+  if (name.empty() || name.size() > MAX_FIELD || pwd.size() > MAX_FIELD) {
+    done(result);
+    return true;
+  }
+  Head head;
+  head.nameLen = static_cast<uint16_t>(name.size());
+  head.pwdLen = static_cast<uint16_t>(pwd.size());
+  std::string data = name + pwd;
+  head.crc = Crc_(head, data.data());
+  size_t size = RecordSize_(head);
+  {
+    std::unique_lock<std::shared_mutex> lock(mtx_);
+    if (!base_) {
+      result.status = ERROR;
+    } else if (index_.count(name)) {
+      result.status = EXISTS;
+    } else if (!Reserve_(size)) {
+      result.status = ERROR;
+    } else {
+      // 对齐填充的字节已是0
+      memcpy(base_ + tail_ + sizeof(Head), data.data(), data.size());
+      memcpy(base_ + tail_, &head, sizeof(head));
+      index_.emplace(name, tail_);
+      tail_ += size;
+      result.status = OK;
+    }
+  }
+  done(result);
+  return true;
+}
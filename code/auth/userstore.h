@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <shared_mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "../log/log.h"
+#include "authbackend.h"
+
+// 进程内的用户存储，不依赖外部服务：文件是只追加的记录日志，整体mmap，
+// 内存里的散列表从用户名映射到记录偏移，查找不做系统调用。
+// 每条记录带CRC，启动时顺序重放重建索引，遇到不完整或校验失败的记录即停止，
+// 其后内容清零，崩溃后总能恢复到一个完整的前缀。
+// 写入只进页缓存，进程崩溃不丢数据；机器掉电可能丢掉最近的注册，Close时落盘
+class UserStore : public AuthBackend {
+public:
+  UserStore() = default;
+  ~UserStore() override { Close(); }
+  UserStore(const UserStore &) = delete;
+  UserStore &operator=(const UserStore &) = delete;
+
+  // 打开或创建存储文件并重建索引；文件不是本格式时返回false
+  bool Open(const std::string &path);
+  void Close();
+  size_t Size();
+
+  bool Lookup(const std::string &name, Callback done) override;
+  bool Insert(const std::string &name, const std::string &pwd,
+              Callback done) override;
+  bool IsInline() const override { return true; }
+
+private:
+  // 记录：头部 + 用户名 + 密码，按8字节对齐。crc覆盖两个长度和内容
+  struct Head {
+    uint32_t crc;
+    uint16_t nameLen;
+    uint16_t pwdLen;
+  };
+
+  size_t Recover_();
+  bool Reserve_(size_t bytes);
+  static size_t RecordSize_(const Head &head);
+  static uint32_t Crc_(const Head &head, const char *data);
+
+  static constexpr char MAGIC[8] = {'W', 'S', 'U', 'S', 'E', 'R', '1', '\n'};
+  static constexpr size_t INIT_SIZE = 1 << 20;
+  static constexpr size_t MAX_FIELD = 0xFFFF;
+
+  int fd_ = -1;
+  char *base_ = nullptr;
+  size_t cap_ = 0;  // 映射长度，即文件长度
+  size_t tail_ = 0; // 下一条记录写入的位置
+  std::unordered_map<std::string, size_t> index_;
+  std::shared_mutex mtx_; // 查找共享，追加和扩容独占
+};
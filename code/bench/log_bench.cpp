@@ -0,0 +1,63 @@
+// 多线程写日志：每次LOG_INFO的调用耗时，以及写线程是否跟得上
+// 默认异步(每线程缓冲区)，queue传0为同步写；mode为Log::MODE(0文本 1延迟 2二进制)
+// ../bin/log_bench [threads] [lines] [queue] [mode]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../log/log.h"
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+const int BATCH = 1024;
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 8;
+  int lines = argc > 2 ? atoi(argv[2]) : 200000;
+  int queue = argc > 3 ? atoi(argv[3]) : 1024;
+  int mode = argc > 4 ? atoi(argv[4]) : Log::TEXT;
+  printf("%d threads, %d lines per thread, queue %d, mode %d\n", threads,
+         lines, queue, mode);
+  Log::Instance()->init(1, "/tmp/log_bench",
+                        mode == Log::BINARY ? ".bin" : ".log", queue, mode);
+
+  std::vector<double> cost(threads);
+  std::vector<std::thread> workers;
+  auto start = BenchClock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      // 每1024行暂停一下，模拟请求处理的间隔；暂停不计入调用耗时
+      double ns = 0;
+      for (int i = 0; i < lines; i += BATCH) {
+        auto begin = BenchClock::now();
+        for (int j = i; j < std::min(lines, i + BATCH); ++j) {
+          LOG_INFO("Client[%d](127.0.0.1:%d) in, userCount:%d", 1000 + j,
+                   40000 + t, j);
+        }
+        ns += std::chrono::duration<double, std::nano>(BenchClock::now() -
+                                                       begin)
+                  .count();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+      }
+      cost[t] = ns / lines;
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  double ms = std::chrono::duration<double, std::milli>(BenchClock::now() -
+                                                        start)
+                  .count();
+  std::sort(cost.begin(), cost.end());
+  printf("  %9.1f ms %10.0f lines/s  per call p50 %.0f ns  max %.0f ns\n",
+         ms, threads * static_cast<double>(lines) * 1000.0 / ms,
+         cost[threads / 2], cost.back());
+  return 0;
+}
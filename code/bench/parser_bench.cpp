@@ -0,0 +1,172 @@
+// 请求解析吞吐：原std::regex逐行解析 vs 增量式解析器，
+// 以及分隔符扫描各实现(scalar/sse2/avx2)的速度
+// ../bin/parser_bench [seconds]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <regex>
+#include <string>
+#include <unordered_map>
+
+#include "../buffer/buffer.h"
+#include "../http/delimscan.h"
+#include "../http/httprequest.h"
+
+namespace {
+
+// 改写前HttpRequest::parse的做法：std::search找CRLF，每行拷贝成string，
+// 每行新建一个std::regex
+class RegexParser {
+public:
+  bool parse(Buffer &buff) {
+    const char END[] = "\r\n";
+    state_ = 0;
+    header_.clear();
+    while (buff.ReadableBytes() && state_ != 3) {
+      const char *lineend =
+          std::search(buff.Peek(), buff.BeginWriteConst(), END, END + 2);
+      std::string line(buff.Peek(), lineend);
+      if (state_ == 0) {
+        std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+        std::smatch match;
+        if (!std::regex_match(line, match, patten))
+          return false;
+        method_ = match[1];
+        path_ = match[2];
+        version_ = match[3];
+        state_ = 1;
+      } else if (state_ == 1) {
+        std::regex patten("^([^:]*) ?(.*)$");
+        std::smatch match;
+        if (std::regex_match(line, match, patten)) {
+          header_[match[1]] = match[2];
+        } else {
+          state_ = 2;
+        }
+        if (buff.ReadableBytes() <= 2)
+          state_ = 3;
+      } else {
+        body_ = line;
+        state_ = 3;
+      }
+      if (lineend == buff.BeginWrite()) {
+        buff.RetrieveAll();
+        break;
+      }
+      buff.RetrieveUntil(lineend + 2);
+    }
+    return true;
+  }
+
+private:
+  int state_;
+  std::string method_, path_, version_, body_;
+  std::unordered_map<std::string, std::string> header_;
+};
+
+const char *SIMPLE_REQ = "GET /index.html HTTP/1.1\r\n"
+                         "Host: 127.0.0.1:1234\r\n"
+                         "Connection: keep-alive\r\n"
+                         "\r\n";
+
+const char *BROWSER_REQ =
+    "GET /css/bootstrap.min.css HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, "
+    "like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Referer: http://example.com/index.html\r\n"
+    "Cookie: sessionid=0123456789abcdef0123456789abcdef; "
+    "csrftoken=abcdefabcdefabcdefabcdefabcdefab; theme=dark; "
+    "_ga=GA1.2.1234567890.1234567890; _gid=GA1.2.0987654321.0987654321\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "\r\n";
+
+// 每种解析器跑满seconds秒，按完成的请求数计算吞吐
+template <typename F>
+double Run(const char *name, const char *req, double seconds, F parseOnce) {
+  Buffer buff(4096);
+  size_t len = strlen(req);
+  long n = 0;
+  auto begin = std::chrono::steady_clock::now();
+  std::chrono::duration<double> sec(0);
+  while (sec.count() < seconds) {
+    for (int i = 0; i < 64; ++i, ++n) {
+      buff.Append(req, len);
+      if (!parseOnce(buff)) {
+        fprintf(stderr, "%s: parse failed\n", name);
+        exit(1);
+      }
+    }
+    sec = std::chrono::steady_clock::now() - begin;
+  }
+  double rate = n / sec.count();
+  printf("  %-12s %12.0f req/s\n", name, rate);
+  return rate;
+}
+
+void Compare(const char *title, const char *req, double seconds) {
+  printf("%s (%zu bytes)\n", title, strlen(req));
+  RegexParser legacy;
+  double oldRate = Run("regex", req, seconds,
+                       [&](Buffer &buff) { return legacy.parse(buff); });
+  HttpRequest request;
+  double newRate = Run("incremental", req, seconds, [&](Buffer &buff) {
+    request.Init();
+    if (request.parse(buff) != HttpRequest::COMPLETE)
+      return false;
+    buff.Retrieve(request.RequestBytes());
+    return true;
+  });
+  printf("  speedup      %12.1fx\n", newRate / oldRate);
+  fflush(stdout);
+}
+
+void CompareScan(const char *req, double seconds) {
+  printf("delimiter scan (active: %s)\n", delimscan::ImplName());
+  size_t nblocks = strlen(req) / 64;
+  std::vector<delimscan::Block> out(nblocks);
+  struct {
+    const char *name;
+    delimscan::ScanFunc func;
+    bool usable;
+  } impls[] = {
+      {"scalar", delimscan::ScanScalar, true},
+      {"sse2", delimscan::ScanSse2, delimscan::HasSse2()},
+      {"avx2", delimscan::ScanAvx2, delimscan::HasAvx2()},
+  };
+  for (auto &impl : impls) {
+    if (!impl.usable) {
+      continue;
+    }
+    long n = 0;
+    uint64_t sink = 0;
+    auto begin = std::chrono::steady_clock::now();
+    std::chrono::duration<double> sec(0);
+    while (sec.count() < seconds) {
+      for (int i = 0; i < 1024; ++i, ++n) {
+        impl.func(req, nblocks, out.data());
+        sink += out[0].lf;
+      }
+      sec = std::chrono::steady_clock::now() - begin;
+    }
+    printf("  %-12s %12.2f GB/s%s\n", impl.name,
+           n * nblocks * 64 / sec.count() / 1e9, sink ? "" : " ");
+  }
+  fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  Compare("simple GET", SIMPLE_REQ, seconds);
+  Compare("browser GET", BROWSER_REQ, seconds);
+  CompareScan(BROWSER_REQ, seconds);
+  return 0;
+}
@@ -0,0 +1,88 @@
+// 线程池：ThreadPool(单队列+互斥锁) vs WorkStealingPool
+// 吞吐：单个提交线程连续提交小任务，统计每秒完成的任务数；
+// 唤醒延迟：worker空闲后提交一个任务，统计从提交到开始执行的时间
+// ../bin/pool_bench [threads] [tasks]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../pool/threadpool.h"
+#include "../pool/workstealingpool.h"
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+template <typename Pool> void Throughput(const char *name, Pool &pool, int n) {
+  std::atomic<int> done(0);
+  auto begin = BenchClock::now();
+  for (int i = 0; i < n; ++i) {
+    pool.AddTask([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+  }
+  while (done.load() < n) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double> sec = BenchClock::now() - begin;
+  printf("  %-18s %12.0f tasks/s\n", name, n / sec.count());
+  fflush(stdout);
+}
+
+// gap为两次提交之间的空闲时间：短间隔时worker还在自旋，长间隔时已休眠
+template <typename Pool>
+void Wakeup(const char *name, Pool &pool, int rounds,
+            std::chrono::microseconds gap) {
+  std::vector<double> lat;
+  lat.reserve(rounds);
+  for (int i = 0; i < rounds; ++i) {
+    std::this_thread::sleep_for(gap);
+    std::atomic<bool> ran(false);
+    double us = 0;
+    auto submit = BenchClock::now();
+    pool.AddTask([&] {
+      us = std::chrono::duration<double, std::micro>(BenchClock::now() -
+                                                     submit)
+               .count();
+      ran.store(true, std::memory_order_release);
+    });
+    while (!ran.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    lat.push_back(us);
+  }
+  std::sort(lat.begin(), lat.end());
+  double sum = 0;
+  for (double v : lat) {
+    sum += v;
+  }
+  printf("  %-18s gap %5ldus  avg %8.1f us  p50 %8.1f us  p99 %8.1f us\n",
+         name, static_cast<long>(gap.count()), sum / rounds,
+         lat[rounds / 2], lat[rounds * 99 / 100]);
+  fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 16;
+  int tasks = argc > 2 ? atoi(argv[2]) : 2000000;
+  printf("%d threads, %d tasks, %u cpus\n", threads, tasks,
+         std::thread::hardware_concurrency());
+  ThreadPool mutexPool(threads);
+  WorkStealingPool stealPool(threads);
+
+  printf("throughput\n");
+  Throughput("ThreadPool", mutexPool, tasks);
+  Throughput("WorkStealingPool", stealPool, tasks);
+
+  printf("wakeup latency\n");
+  for (int gap : {20, 1000}) {
+    Wakeup("ThreadPool", mutexPool, 2000, std::chrono::microseconds(gap));
+    Wakeup("WorkStealingPool", stealPool, 2000,
+           std::chrono::microseconds(gap));
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+// 内嵌用户存储UserStore：注册吞吐(含文件扩容)与多线程登录查找延迟
+// ../bin/store_bench [users] [threads] [path]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../auth/userstore.h"
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+std::string Name(int i) { return "user" + std::to_string(i); }
+
+void Insert(UserStore &store, int users) {
+  auto start = BenchClock::now();
+  int ok = 0;
+  for (int i = 0; i < users; ++i) {
+    store.Insert(Name(i), "pwd" + std::to_string(i),
+                 [&ok](const AuthBackend::Result &res) {
+                   ok += res.status == AuthBackend::OK;
+                 });
+  }
+  double ms = std::chrono::duration<double, std::milli>(BenchClock::now() -
+                                                        start)
+                  .count();
+  printf("  insert   %8d users %9.1f ms %10.0f /s\n", ok, ms,
+         users * 1000.0 / ms);
+}
+
+// 每个线程随机查找已有用户，统计每次查找的延迟
+void Lookup(UserStore &store, int users, int threads, int rounds) {
+  std::vector<std::vector<double>> lats(threads);
+  std::atomic<int> found{0};
+  std::vector<std::thread> workers;
+  auto start = BenchClock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      std::vector<double> &lat = lats[t];
+      lat.reserve(rounds);
+      int n = 0;
+      for (int i = 0; i < rounds; ++i) {
+        std::string name = Name(rng() % users);
+        auto begin = BenchClock::now();
+        store.Lookup(name, [&n](const AuthBackend::Result &res) {
+          n += res.status == AuthBackend::OK;
+        });
+        lat.push_back(std::chrono::duration<double, std::micro>(
+                          BenchClock::now() - begin)
+                          .count());
+      }
+      found += n;
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  double ms = std::chrono::duration<double, std::milli>(BenchClock::now() -
+                                                        start)
+                  .count();
+  std::vector<double> all;
+  for (std::vector<double> &lat : lats) {
+    all.insert(all.end(), lat.begin(), lat.end());
+  }
+  std::sort(all.begin(), all.end());
+  printf("  lookup   %8d found %9.1f ms %10.0f /s  p50 %.2f us  p99 %.2f us\n",
+         found.load(), ms, all.size() * 1000.0 / ms, all[all.size() / 2],
+         all[all.size() * 99 / 100]);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int users = argc > 1 ? atoi(argv[1]) : 200000;
+  int threads = argc > 2 ? atoi(argv[2]) : 8;
+  std::string path = argc > 3 ? argv[3] : "/tmp/store_bench.db";
+  unlink(path.c_str());
+  printf("%d users, %d threads, %s\n", users, threads, path.c_str());
+  {
+    UserStore store;
+    if (!store.Open(path)) {
+      return 1;
+    }
+    Insert(store, users);
+    Lookup(store, users, threads, 200000);
+  }
+  // 重新打开，重放日志重建索引
+  auto start = BenchClock::now();
+  UserStore store;
+  if (!store.Open(path)) {
+    return 1;
+  }
+  double ms = std::chrono::duration<double, std::milli>(BenchClock::now() -
+                                                        start)
+                  .count();
+  printf("  recover  %8zu users %9.1f ms\n", store.Size(), ms);
+  store.Close();
+  unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,129 @@
+// 连接超时定时器：HeapTimer vs TimingWheel
+// 模拟n个keep-alive连接，每个连接一个定时器，统计建立、事件续期、
+// 关闭连接的耗时，以及短超时下到期回调的延迟
+// ../bin/timer_bench [timers] [events]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../timer/timer.h"
+#include "../timer/timingwheel.h"
+
+namespace {
+
+const int TIMEOUT_MS = 60000;
+
+typedef std::chrono::steady_clock BenchClock;
+
+double NsPerOp(BenchClock::time_point begin, size_t ops) {
+  std::chrono::duration<double, std::nano> ns = BenchClock::now() - begin;
+  return ns.count() / ops;
+}
+
+// 两种定时器的统一接口，HeapTimer每个节点带一个回调
+struct HeapAdapter {
+  HeapTimer timer;
+  std::vector<int> *fired;
+  void add(int id, int ms) {
+    timer.add(id, ms, [this, id] { fired->push_back(id); });
+  }
+  void adjust(int id, int ms) { timer.adjust(id, ms); }
+  void del(int id) { timer.doWork(id); }
+  int GetNextTick() { return timer.GetNextTick(); }
+};
+
+struct WheelAdapter {
+  TimingWheel timer;
+  std::vector<int> *fired;
+  explicit WheelAdapter(std::vector<int> *out)
+      : timer([out](int id) { out->push_back(id); }), fired(out) {}
+  void add(int id, int ms) { timer.add(id, ms); }
+  void adjust(int id, int ms) { timer.adjust(id, ms); }
+  void del(int id) { timer.del(id); }
+  int GetNextTick() { return timer.GetNextTick(); }
+};
+
+template <typename T>
+void Run(const char *name, T &t, std::vector<int> &fired, int n, int events) {
+  std::mt19937 rng(12345);
+  printf("%s\n", name);
+
+  auto begin = BenchClock::now();
+  for (int i = 0; i < n; ++i) {
+    t.add(i, TIMEOUT_MS);
+  }
+  printf("  add      %10.1f ns/op\n", NsPerOp(begin, n));
+
+  // 每个事件把对应连接的超时往后推，并驱动一次事件循环
+  std::vector<int> ids(events);
+  for (int &id : ids) {
+    id = rng() % n;
+  }
+  begin = BenchClock::now();
+  for (int i = 0; i < events; ++i) {
+    t.adjust(ids[i], TIMEOUT_MS);
+    if ((i & 63) == 0) {
+      t.GetNextTick();
+    }
+  }
+  printf("  adjust   %10.1f ns/op\n", NsPerOp(begin, events));
+
+  // HeapTimer没有单纯删除，doWork会执行回调后删除
+  begin = BenchClock::now();
+  for (int i = 0; i < n; ++i) {
+    t.del(i);
+  }
+  printf("  del      %10.1f ns/op\n", NsPerOp(begin, n));
+  fired.clear();
+
+  // 短超时全部到期，按事件循环的方式等待，统计相对期望时间的延迟
+  std::vector<BenchClock::time_point> deadline(n);
+  begin = BenchClock::now();
+  for (int i = 0; i < n; ++i) {
+    int ms = 1 + rng() % 500;
+    deadline[i] = BenchClock::now() + std::chrono::milliseconds(ms);
+    t.add(i, ms);
+  }
+  double maxLate = 0, sumLate = 0;
+  int early = 0;
+  size_t done = 0;
+  while (done < static_cast<size_t>(n)) {
+    int ms = t.GetNextTick();
+    for (; done < fired.size(); ++done) {
+      std::chrono::duration<double, std::milli> late =
+          BenchClock::now() - deadline[fired[done]];
+      if (late.count() < -1.0) {
+        ++early;
+      }
+      maxLate = std::max(maxLate, late.count());
+      sumLate += late.count();
+    }
+    if (ms > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+  }
+  printf("  expire   avg late %.2f ms, max late %.2f ms, early %d\n",
+         sumLate / n, maxLate, early);
+  fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 100000;
+  int events = argc > 2 ? atoi(argv[2]) : 4000000;
+  printf("%d timers, %d events\n", n, events);
+  std::vector<int> fired;
+  {
+    HeapAdapter heap{HeapTimer(), &fired};
+    Run("HeapTimer", heap, fired, n, events);
+  }
+  {
+    WheelAdapter wheel(&fired);
+    Run("TimingWheel", wheel, fired, n, events);
+  }
+  return 0;
+}
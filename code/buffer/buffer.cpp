@@ -19,7 +19,13 @@ void Buffer::EnsureWritable(size_t len) {
 
 void Buffer::HasWritten(size_t len) { writePos += len; }
 
-void Buffer::Retrieve(size_t len) { readPos += len; }
+void Buffer::Retrieve(size_t len) {
+  assert(len <= ReadableBytes());
+  readPos += len;
+  if (readPos == writePos) {
+    readPos = writePos = 0;
+  }
+}
 
 void Buffer::RetrieveUntil(const char *end) {
   assert(Peek() <= end);
@@ -27,7 +33,7 @@ void Buffer::RetrieveUntil(const char *end) {
 }
 
 void Buffer::RetrieveAll() {
-  std::memset(reinterpret_cast<void *>(&buffer_), '\0', buffer_.size());
+  std::memset(&buffer_[0], '\0', buffer_.size());
   readPos = writePos = 0;
 }
 
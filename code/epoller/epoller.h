@@ -8,16 +8,18 @@
 #include <unistd.h>
 #include <vector>
 
-class Epoller {
+#include "poller.h"
+
+class Epoller : public Poller {
 public:
   explicit Epoller(int maxEvent = 1024);
-  ~Epoller();
-  bool AddFd(int fd, uint32_t events);
-  bool ModFd(int fd, uint32_t events);
-  bool DelFd(int fd);
-  int Wait(int timeoutMS = -1);
-  int GetEventFd(size_t i) const;
-  uint32_t GetEvents(size_t i) const;
+  ~Epoller() override;
+  bool AddFd(int fd, uint32_t events) override;
+  bool ModFd(int fd, uint32_t events) override;
+  bool DelFd(int fd) override;
+  int Wait(int timeoutMS = -1) override;
+  int GetEventFd(size_t i) const override;
+  uint32_t GetEvents(size_t i) const override;
 
 private:
   int epollFd_;
@@ -0,0 +1,15 @@
+#include "poller.h"
+#include "../log/log.h"
+#include "epoller.h"
+#include "uringpoller.h"
+
+std::unique_ptr<Poller> Poller::Create(bool useUring, int maxEvent) {
+  if (useUring) {
+    std::unique_ptr<UringPoller> uring(new UringPoller(maxEvent));
+    if (uring->IsValid()) {
+      return std::move(uring);
+    }
+    LOG_WARN("io_uring unavailable, fall back to epoll");
+  }
+  return std::unique_ptr<Poller>(new Epoller(maxEvent));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/socket.h>
+
+// 事件后端接口，事件位沿用EPOLLIN/EPOLLOUT/EPOLLONESHOT等
+class Poller {
+public:
+  virtual ~Poller() = default;
+  virtual bool AddFd(int fd, uint32_t events) = 0;
+  virtual bool ModFd(int fd, uint32_t events) = 0;
+  virtual bool DelFd(int fd) = 0;
+  virtual int Wait(int timeoutMS = -1) = 0;
+  virtual int GetEventFd(size_t i) const = 0;
+  virtual uint32_t GetEvents(size_t i) const = 0;
+
+  // 完成式I/O，只有io_uring在内核支持时实现，返回false时调用方改用AddFd/ModFd。
+  // AcceptMulti：在监听fd上持续accept，每个新连接作为该fd上的一个事件，
+  // 结果为新连接的fd(已非阻塞)，用DelFd停止。
+  // RecvOnce：相当于AddFd/ModFd(fd, EPOLLIN | EPOLLONESHOT)，但可读时直接收进
+  // 内部的缓冲区，结果为recv的返回值(0为对端关闭，负数为-errno)
+  // SendMsg：sendmsg请求，与下一次Wait一起提交，结果为sendmsg的返回值。
+  // 完成之前msg和它引用的数据必须保持不变，fd也不能关闭；同一fd同时只能有一个。
+  // DelFd会取消还没完成的发送，但完成事件(可能是-ECANCELED)总会送来
+  virtual bool AcceptMulti(int listenFd) { return false; }
+  virtual bool RecvOnce(int fd) { return false; }
+  virtual bool SendMsg(int fd, const struct msghdr *msg, int flags) {
+    return false;
+  }
+  // 第i个事件是完成事件时返回true，data指向收到的数据，在下一次Wait之前有效
+  virtual bool GetResult(size_t i, int *res, const char **data) const {
+    return false;
+  }
+  // 第i个事件是SendMsg的完成事件
+  virtual bool IsSent(size_t i) const { return false; }
+
+  // useUring为true时优先使用io_uring，内核不支持则退回epoll
+  static std::unique_ptr<Poller> Create(bool useUring, int maxEvent = 1024);
+};
@@ -0,0 +1,593 @@
+#include "uringpoller.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "../log/log.h"
+
+namespace {
+
+// 只把poll关心的位交给内核，EPOLLET/EPOLLONESHOT由本类自行处理
+const uint32_t POLL_MASK =
+    EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+
+int SysSetup(unsigned entries, io_uring_params *p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int SysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+             const void *arg, size_t argSize) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit,
+                                  minComplete, flags, arg, argSize));
+}
+
+int SysRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+} // namespace
+
+
+UringPoller::UringPoller(int maxEvent)
+    : ringFd_(-1), multishot_(false), acceptMulti_(false), recvBuf_(false),
+      sendMsg_(false), sqEntries_(0), sqRing_(MAP_FAILED), sqRingSize_(0),
+      cqRing_(MAP_FAILED), cqRingSize_(0), sqes_(nullptr), sqesSize_(0),
+      bufRing_(nullptr), bufRingSize_(0), bufTail_(0), events_(maxEvent) {
+  assert(events_.size() > 0);
+  Setup_(static_cast<unsigned>(maxEvent));
+}
+
+UringPoller::~UringPoller() { Teardown_(); }
+
+bool UringPoller::Setup_(unsigned entries) {
+  io_uring_params p = {};
+  ringFd_ = SysSetup(entries, &p);
+  if (ringFd_ < 0) {
+    return false;
+  }
+  // 依赖带超时的等待(5.11)，NODROP保证CQ溢出时不丢事件
+  if (!(p.features & IORING_FEAT_EXT_ARG) ||
+      !(p.features & IORING_FEAT_NODROP)) {
+    Teardown_();
+    return false;
+  }
+  sqEntries_ = p.sq_entries;
+
+  sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+  sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) {
+    Teardown_();
+    return false;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) {
+      Teardown_();
+      return false;
+    }
+  }
+  sqesSize_ = p.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    Teardown_();
+    return false;
+  }
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(sqRing_);
+  char *cq = static_cast<char *>(cqRing_);
+  sqHead_ = reinterpret_cast<std::atomic<unsigned> *>(sq + p.sq_off.head);
+  sqTail_ = reinterpret_cast<std::atomic<unsigned> *>(sq + p.sq_off.tail);
+  sqMask_ = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  cqHead_ = reinterpret_cast<std::atomic<unsigned> *>(cq + p.cq_off.head);
+  cqTail_ = reinterpret_cast<std::atomic<unsigned> *>(cq + p.cq_off.tail);
+  cqMask_ = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+  if (!OpSupported_(IORING_OP_POLL_ADD) ||
+      !OpSupported_(IORING_OP_ASYNC_CANCEL)) {
+    Teardown_();
+    return false;
+  }
+  multishot_ = ProbePollMulti_();
+  acceptMulti_ = ProbeAcceptMulti_();
+  recvBuf_ = OpSupported_(IORING_OP_RECV) && SetupBufRing_();
+  sendMsg_ = OpSupported_(IORING_OP_SENDMSG);
+  LOG_INFO("io_uring multishot poll: %d, multishot accept: %d, "
+           "provided-buffer recv: %d, sendmsg: %d",
+           multishot_, acceptMulti_, recvBuf_, sendMsg_);
+  return true;
+}
+
+void UringPoller::Teardown_() {
+  if (sqes_) {
+    munmap(sqes_, sqesSize_);
+    sqes_ = nullptr;
+  }
+  if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  cqRing_ = MAP_FAILED;
+  if (sqRing_ != MAP_FAILED) {
+    munmap(sqRing_, sqRingSize_);
+    sqRing_ = MAP_FAILED;
+  }
+  if (ringFd_ >= 0) {
+    close(ringFd_);
+    ringFd_ = -1;
+  }
+  // 环关闭后内核不再引用缓冲区环
+  if (bufRing_) {
+    munmap(bufRing_, bufRingSize_);
+    bufRing_ = nullptr;
+  }
+}
+
+bool UringPoller::OpSupported_(uint8_t op) {
+  size_t size =
+      sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+  std::unique_ptr<char[]> buf(new char[size]());
+  io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(buf.get());
+  if (SysRegister(ringFd_, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+    return false;
+  }
+  return op <= probe->last_op &&
+         (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+// 初始化时同步执行一个请求，返回它第一个完成事件的结果
+int UringPoller::Probe_(const io_uring_sqe &req, uint64_t userData,
+                        uint32_t *flags) {
+  io_uring_sqe *sqe = GetSqe_();
+  if (!sqe) {
+    return -EBUSY;
+  }
+  *sqe = req;
+  sqe->user_data = userData;
+  if (Submit_() < 0) {
+    return -errno;
+  }
+  while (true) {
+    unsigned head = cqHead_->load(std::memory_order_relaxed);
+    unsigned tail = cqTail_->load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe &cqe = cqes_[head & cqMask_];
+      if (cqe.user_data == userData) {
+        int res = cqe.res;
+        *flags = cqe.flags;
+        cqHead_->store(head + 1, std::memory_order_release);
+        return res;
+      }
+    }
+    cqHead_->store(head, std::memory_order_release);
+    if (Enter_(0, 1, -1) < 0 && errno != EINTR) {
+      return -errno;
+    }
+  }
+}
+
+// 旧内核对不认识的标志返回-EINVAL。在可写的管道上挂一个多次触发的poll，
+// 支持时立即完成且带IORING_CQE_F_MORE，随后取消
+bool UringPoller::ProbePollMulti_() {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    return false;
+  }
+  io_uring_sqe req = {};
+  req.opcode = IORING_OP_POLL_ADD;
+  req.fd = fds[1];
+  req.poll32_events = EPOLLOUT;
+  req.len = IORING_POLL_ADD_MULTI;
+  uint32_t flags = 0;
+  bool ok = Probe_(req, PROBE_DATA, &flags) >= 0;
+  if (flags & IORING_CQE_F_MORE) {
+    io_uring_sqe cancel = {};
+    cancel.opcode = IORING_OP_ASYNC_CANCEL;
+    cancel.fd = -1;
+    cancel.addr = PROBE_DATA;
+    Probe_(cancel, INTERNAL_DATA, &flags);
+  } else {
+    ok = false;
+  }
+  close(fds[0]);
+  close(fds[1]);
+  return ok;
+}
+
+// 对管道accept：不支持多次accept的内核在准备阶段就返回-EINVAL，
+// 支持的会真正去accept，因为不是socket而失败
+bool UringPoller::ProbeAcceptMulti_() {
+  if (!OpSupported_(IORING_OP_ACCEPT)) {
+    return false;
+  }
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    return false;
+  }
+  io_uring_sqe req = {};
+  req.opcode = IORING_OP_ACCEPT;
+  req.fd = fds[0];
+  req.ioprio = IORING_ACCEPT_MULTISHOT;
+  req.accept_flags = SOCK_NONBLOCK;
+  uint32_t flags = 0;
+  int res = Probe_(req, PROBE_DATA, &flags);
+  close(fds[0]);
+  close(fds[1]);
+  return res != -EINVAL;
+}
+
+// 缓冲区环(5.19)注册失败时RECV不可用，连接照常用poll等待可读
+bool UringPoller::SetupBufRing_() {
+  bufRingSize_ = BUF_COUNT * sizeof(io_uring_buf);
+  void *ring = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  io_uring_buf_reg reg = {};
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = BUF_COUNT;
+  reg.bgid = BUF_GROUP;
+  if (SysRegister(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    munmap(ring, bufRingSize_);
+    return false;
+  }
+  bufRing_ = static_cast<io_uring_buf *>(ring);
+  bufs_.reset(new char[BUF_COUNT * BUF_SIZE]);
+  for (unsigned i = 0; i < BUF_COUNT; ++i) {
+    PutBuf_(static_cast<uint16_t>(i));
+  }
+  PublishBufs_();
+  return true;
+}
+
+// 环尾和第0项的resv重叠，只写addr/len/bid
+void UringPoller::PutBuf_(uint16_t bid) {
+  io_uring_buf &buf = bufRing_[bufTail_ & (BUF_COUNT - 1)];
+  buf.addr = reinterpret_cast<uint64_t>(bufs_.get() + bid * BUF_SIZE);
+  buf.len = BUF_SIZE;
+  buf.bid = bid;
+  ++bufTail_;
+}
+
+void UringPoller::PublishBufs_() {
+  reinterpret_cast<std::atomic<uint16_t> *>(&bufRing_[0].resv)
+      ->store(bufTail_, std::memory_order_release);
+}
+
+// 调用方持有mtx_。SQ已满时先把积压的请求交给内核，CQ溢出时内核返回EBUSY，
+// 稍等再试；仍然取不到时返回nullptr，由调用方报告失败
+io_uring_sqe *UringPoller::GetSqe_() {
+  unsigned tail = sqTail_->load(std::memory_order_relaxed);
+  for (int i = 0; tail - sqHead_->load(std::memory_order_acquire) >= sqEntries_;
+       ++i) {
+    if (i == SUBMIT_RETRY) {
+      return nullptr;
+    }
+    if (i > 0) {
+      std::this_thread::yield();
+    }
+    Submit_();
+  }
+  unsigned idx = tail & sqMask_;
+  io_uring_sqe *sqe = &sqes_[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqArray_[idx] = idx;
+  sqTail_->store(tail + 1, std::memory_order_release);
+  return sqe;
+}
+
+bool UringPoller::Prep_(int fd, FdState &st) {
+  io_uring_sqe *sqe = GetSqe_();
+  if (!sqe) {
+    LOG_ERROR("io_uring submission queue stuck, fd %d not armed", fd);
+    return false;
+  }
+  sqe->fd = fd;
+  sqe->user_data = UserData_(fd, st.gen, st.kind);
+  switch (st.kind) {
+  case ACCEPT:
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    break;
+  case RECV:
+    sqe->opcode = IORING_OP_RECV;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->len = BUF_SIZE;
+    break;
+  default:
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->poll32_events = st.events & POLL_MASK;
+    // 边沿触发且非ONESHOT(监听socket)用多次触发poll，省去每次重新提交
+    if (multishot_ && (st.events & EPOLLET) && !(st.events & EPOLLONESHOT)) {
+      sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    break;
+  }
+  st.armed = true;
+  return true;
+}
+
+void UringPoller::PrepCancel_(int fd, uint64_t userData) {
+  io_uring_sqe *sqe = GetSqe_();
+  if (!sqe) {
+    LOG_ERROR("io_uring submission queue stuck, fd %d not cancelled", fd);
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = userData;
+  sqe->user_data = INTERNAL_DATA;
+}
+
+// 调用方持有mtx_，非事件循环线程的修改立即提交，否则循环可能一直睡在Wait里
+void UringPoller::SubmitIfForeign_() {
+  if (std::this_thread::get_id() != owner_) {
+    Submit_();
+  }
+}
+
+// 调用方持有mtx_，提交SQ里内核还没取走的请求
+int UringPoller::Submit_() {
+  unsigned toSubmit = sqTail_->load(std::memory_order_relaxed) -
+                      sqHead_->load(std::memory_order_acquire);
+  return toSubmit ? Enter_(toSubmit, 0, 0) : 0;
+}
+
+// 有挂着的请求先取消；create为false时fd必须已登记
+bool UringPoller::Arm_(int fd, uint32_t events, KIND kind, bool create) {
+  if (fd < 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto it = fds_.find(fd);
+  if (it == fds_.end()) {
+    if (!create) {
+      return false;
+    }
+    it = fds_.emplace(fd, FdState{0, 0, false, POLL, 0}).first;
+  }
+  FdState &st = it->second;
+  if (st.armed) {
+    PrepCancel_(fd, UserData_(fd, st.gen, st.kind));
+  }
+  ++st.gen;
+  st.events = events;
+  st.kind = kind;
+  st.armed = false;
+  bool ok = Prep_(fd, st);
+  SubmitIfForeign_();
+  return ok;
+}
+
+bool UringPoller::AddFd(int fd, uint32_t events) {
+  return Arm_(fd, events, POLL, true);
+}
+
+bool UringPoller::ModFd(int fd, uint32_t events) {
+  return Arm_(fd, events, POLL, false);
+}
+
+bool UringPoller::AcceptMulti(int listenFd) {
+  return acceptMulti_ && Arm_(listenFd, EPOLLIN, ACCEPT, true);
+}
+
+bool UringPoller::RecvOnce(int fd) {
+  return recvBuf_ && Arm_(fd, EPOLLIN | EPOLLONESHOT, RECV, true);
+}
+
+// 发送不占用fd上挂着的poll/recv，单独记下user_data以便DelFd取消
+bool UringPoller::SendMsg(int fd, const struct msghdr *msg, int flags) {
+  if (!sendMsg_ || fd < 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto it = fds_.find(fd);
+  if (it == fds_.end() || it->second.sendData) {
+    return false;
+  }
+  io_uring_sqe *sqe = GetSqe_();
+  if (!sqe) {
+    LOG_ERROR("io_uring submission queue stuck, fd %d not sent", fd);
+    return false;
+  }
+  FdState &st = it->second;
+  st.sendData = UserData_(fd, st.gen, SEND);
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(msg);
+  sqe->len = 1;
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  sqe->user_data = st.sendData;
+  SubmitIfForeign_();
+  return true;
+}
+
+bool UringPoller::DelFd(int fd) {
+  if (fd < 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto it = fds_.find(fd);
+  if (it == fds_.end()) {
+    return false;
+  }
+  FdState &st = it->second;
+  if (st.armed) {
+    PrepCancel_(fd, UserData_(fd, st.gen, st.kind));
+  }
+  if (st.sendData) {
+    PrepCancel_(fd, st.sendData);
+  }
+  // 保留gen，fd被复用时旧的完成事件仍能被识别为过期
+  ++st.gen;
+  st.armed = false;
+  SubmitIfForeign_();
+  return true;
+}
+
+int UringPoller::Enter_(unsigned toSubmit, unsigned minComplete,
+                        int timeoutMS) {
+  unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+  if (minComplete && timeoutMS >= 0) {
+    __kernel_timespec ts;
+    ts.tv_sec = timeoutMS / 1000;
+    ts.tv_nsec = static_cast<long long>(timeoutMS % 1000) * 1000000;
+    io_uring_getevents_arg arg = {};
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    return SysEnter(ringFd_, toSubmit, minComplete,
+                    flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  }
+  return SysEnter(ringFd_, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+int UringPoller::Wait(int timeoutMS) {
+  unsigned toSubmit;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    owner_ = std::this_thread::get_id();
+    // 上一批事件的数据调用方已经处理完，缓冲区还给内核
+    if (!held_.empty()) {
+      for (uint16_t bid : held_) {
+        PutBuf_(bid);
+      }
+      held_.clear();
+      PublishBufs_();
+    }
+    toSubmit = sqTail_->load(std::memory_order_relaxed) -
+               sqHead_->load(std::memory_order_acquire);
+  }
+  bool ready = cqHead_->load(std::memory_order_relaxed) !=
+               cqTail_->load(std::memory_order_acquire);
+  unsigned minComplete = (ready || timeoutMS == 0) ? 0 : 1;
+  if (toSubmit || minComplete) {
+    int ret = Enter_(toSubmit, minComplete, timeoutMS);
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+      return -1;
+    }
+  }
+  return Reap_();
+}
+
+int UringPoller::Reap_() {
+  int n = 0;
+  int maxEvents = static_cast<int>(events_.size());
+  unsigned head = cqHead_->load(std::memory_order_relaxed);
+  unsigned tail = cqTail_->load(std::memory_order_acquire);
+  std::lock_guard<std::mutex> lock(mtx_);
+  for (; head != tail && n < maxEvents; ++head) {
+    const io_uring_cqe &cqe = cqes_[head & cqMask_];
+    // 取到缓冲区的RECV，包括过期的，缓冲区都在下一次Wait时归还
+    const char *data = nullptr;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      uint16_t bid =
+          static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      data = bufs_.get() + bid * BUF_SIZE;
+      held_.push_back(bid);
+    }
+    if (cqe.user_data & INTERNAL_DATA) {
+      continue;
+    }
+    int fd = static_cast<int>(cqe.user_data & 0xffffffffu);
+    uint32_t gen = static_cast<uint32_t>(cqe.user_data >> 32) & GEN_MASK;
+    KIND kind = static_cast<KIND>((cqe.user_data >> 61) & 3);
+    auto it = fds_.find(fd);
+    // 调用方要等发送完成才释放数据、关闭fd，过期和被取消的也要交出去
+    if (kind == SEND) {
+      if (it != fds_.end() && it->second.sendData == cqe.user_data) {
+        it->second.sendData = 0;
+      }
+      events_[n++] = {fd, EPOLLOUT, true, cqe.res, nullptr, SEND};
+      continue;
+    }
+    if (it == fds_.end() || (it->second.gen & GEN_MASK) != gen) {
+      // 取消之前已经accept到的连接照常交出去，否则fd就泄漏了
+      if (kind == ACCEPT && cqe.res >= 0) {
+        events_[n++] = {fd, EPOLLIN, true, cqe.res, nullptr, ACCEPT};
+      }
+      continue;
+    }
+    FdState &st = it->second;
+    if (cqe.res == -ECANCELED) {
+      continue;
+    }
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    Event &ev = events_[n++];
+    ev.fd = fd;
+    ev.done = false;
+    ev.res = 0;
+    ev.data = nullptr;
+    ev.kind = kind;
+    if (kind == POLL) {
+      if (!more) {
+        st.armed = false;
+        // 水平触发的非ONESHOT fd需要重新挂上，语义与epoll一致
+        if (!(st.events & EPOLLONESHOT)) {
+          Prep_(fd, st);
+        }
+      }
+      ev.events = cqe.res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe.res);
+    } else if (kind == ACCEPT) {
+      // 内核结束了多次accept(出错或CQ溢出)，重新挂上
+      if (!more) {
+        st.armed = false;
+        Prep_(fd, st);
+      }
+      ev.events = EPOLLIN;
+      ev.done = true;
+      ev.res = cqe.res;
+    } else {
+      st.armed = false;
+      ev.events = EPOLLIN;
+      // 缓冲区暂时用完，当作普通的可读事件由调用方自己读
+      ev.done = cqe.res != -ENOBUFS;
+      ev.res = cqe.res;
+      ev.data = data;
+    }
+  }
+  cqHead_->store(head, std::memory_order_release);
+  return n;
+}
+
+int UringPoller::GetEventFd(size_t i) const {
+  assert(i < events_.size());
+  return events_[i].fd;
+}
+
+uint32_t UringPoller::GetEvents(size_t i) const {
+  assert(i < events_.size());
+  return events_[i].events;
+}
+
+bool UringPoller::GetResult(size_t i, int *res, const char **data) const {
+  assert(i < events_.size());
+  const Event &ev = events_[i];
+  if (!ev.done) {
+    return false;
+  }
+  *res = ev.res;
+  *data = ev.data;
+  return true;
+}
+
+bool UringPoller::IsSent(size_t i) const {
+  assert(i < events_.size());
+  return events_[i].done && events_[i].kind == SEND;
+}
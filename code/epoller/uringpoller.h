@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <sys/epoll.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "poller.h"
+
+// 基于io_uring的事件后端：普通fd用IORING_OP_POLL_ADD等待就绪；
+// 内核支持时监听fd用多次触发的IORING_OP_ACCEPT，连接的读用带
+// IOSQE_BUFFER_SELECT的IORING_OP_RECV直接收进注册的缓冲区环，省掉accept和readv；
+// 响应用IORING_OP_SENDMSG发送，各连接的发送攒到下一次Wait一起提交。
+// 本线程(调用Wait的线程)发起的修改只写SQE，在下一次Wait时与等待合并成
+// 一次io_uring_enter；其他线程(线程池)的修改立即提交
+class UringPoller : public Poller {
+public:
+  explicit UringPoller(int maxEvent = 1024);
+  ~UringPoller() override;
+  bool IsValid() const { return ringFd_ >= 0; }
+
+  bool AddFd(int fd, uint32_t events) override;
+  bool ModFd(int fd, uint32_t events) override;
+  bool DelFd(int fd) override;
+  int Wait(int timeoutMS = -1) override;
+  int GetEventFd(size_t i) const override;
+  uint32_t GetEvents(size_t i) const override;
+
+  bool AcceptMulti(int listenFd) override;
+  bool RecvOnce(int fd) override;
+  bool SendMsg(int fd, const struct msghdr *msg, int flags) override;
+  bool GetResult(size_t i, int *res, const char **data) const override;
+  bool IsSent(size_t i) const override;
+
+private:
+  enum KIND { POLL, ACCEPT, RECV, SEND };
+
+  struct FdState {
+    uint32_t gen;
+    uint32_t events;
+    bool armed;
+    KIND kind;
+    uint64_t sendData; // 还没完成的发送的user_data，0表示没有
+  };
+
+  struct Event {
+    int fd;
+    uint32_t events;
+    bool done; // 完成事件，res/data有效
+    int res;
+    const char *data;
+    KIND kind;
+  };
+
+  bool Setup_(unsigned entries);
+  void Teardown_();
+  bool OpSupported_(uint8_t op);
+  int Probe_(const io_uring_sqe &req, uint64_t userData, uint32_t *flags);
+  bool ProbePollMulti_();
+  bool ProbeAcceptMulti_();
+  bool SetupBufRing_();
+  void PutBuf_(uint16_t bid);
+  void PublishBufs_();
+  io_uring_sqe *GetSqe_();
+  bool Arm_(int fd, uint32_t events, KIND kind, bool create);
+  bool Prep_(int fd, FdState &st);
+  void PrepCancel_(int fd, uint64_t userData);
+  void SubmitIfForeign_();
+  int Submit_();
+  int Enter_(unsigned toSubmit, unsigned minComplete, int timeoutMS);
+  int Reap_();
+
+  // user_data：最高位为内部请求，其下2位为请求类型，再下29位为代数，低32位为fd
+  static uint64_t UserData_(int fd, uint32_t gen, KIND kind) {
+    return (static_cast<uint64_t>(kind) << 61) |
+           (static_cast<uint64_t>(gen & GEN_MASK) << 32) |
+           static_cast<uint32_t>(fd);
+  }
+
+  static const uint32_t GEN_MASK = (1u << 29) - 1;
+  // 取消请求和初始化时试探请求的完成事件，直接丢弃
+  static const uint64_t INTERNAL_DATA = 1ull << 63;
+  static const uint64_t PROBE_DATA = INTERNAL_DATA | 1;
+  // SQ满且内核暂时不收(CQ溢出)时重试的次数，之后放弃并报告失败
+  static const int SUBMIT_RETRY = 16;
+  // 接收缓冲区：个数为2的幂，大小够放下常见的请求头
+  static const unsigned BUF_COUNT = 256;
+  static const size_t BUF_SIZE = 4096;
+  static const uint16_t BUF_GROUP = 0;
+
+  int ringFd_;
+  bool multishot_;   // 多次触发的poll
+  bool acceptMulti_; // 多次触发的accept
+  bool recvBuf_;     // RECV从缓冲区环里选缓冲区
+  bool sendMsg_;
+  unsigned sqEntries_;
+
+  void *sqRing_;
+  size_t sqRingSize_;
+  void *cqRing_;
+  size_t cqRingSize_;
+  io_uring_sqe *sqes_;
+  size_t sqesSize_;
+
+  std::atomic<unsigned> *sqHead_;
+  std::atomic<unsigned> *sqTail_;
+  unsigned sqMask_;
+  unsigned *sqArray_;
+  std::atomic<unsigned> *cqHead_;
+  std::atomic<unsigned> *cqTail_;
+  unsigned cqMask_;
+  io_uring_cqe *cqes_;
+
+  // 缓冲区环只由Wait所在线程补充。按io_uring_buf数组访问：C++里
+  // io_uring_buf_ring的柔性数组前有个占1字节的空结构，偏移不对
+  io_uring_buf *bufRing_;
+  size_t bufRingSize_;
+  std::unique_ptr<char[]> bufs_;
+  uint16_t bufTail_;
+  std::vector<uint16_t> held_; // 本批事件引用的缓冲区，下一次Wait时归还
+
+  std::mutex mtx_;
+  std::thread::id owner_;
+  std::unordered_map<int, FdState> fds_;
+  std::vector<Event> events_;
+};
@@ -0,0 +1,105 @@
+#include "blobcache.h"
+
+BlobCache *BlobCache::Instance() {
+  static BlobCache cache;
+  return &cache;
+}
+
+BlobCache::BlobCache() : shardBudget_(0), maxFileSize_(0) {}
+
+void BlobCache::Init(size_t budget, size_t maxFileSize) {
+  shardBudget_ = budget / SHARD_NUM;
+  maxFileSize_ = maxFileSize;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.map.clear();
+    shard.lru.clear();
+    shard.bytes = 0;
+  }
+}
+
+bool BlobCache::Cacheable(const CachedFile &file) const {
+  return shardBudget_ > 0 && file.readable && S_ISREG(file.st.st_mode) &&
+         static_cast<size_t>(file.st.st_size) <= maxFileSize_;
+}
+
+BlobCache::Shard &BlobCache::ShardOf_(const Key &key) {
+  return shards_[KeyHash()(key) % SHARD_NUM];
+}
+
+void BlobCache::Erase_(Shard &shard,
+                       std::unordered_map<Key, Node, KeyHash>::iterator it) {
+  shard.bytes -= it->second.blob->size();
+  shard.lru.erase(it->second.pos);
+  shard.map.erase(it);
+}
+
+BlobCache::BlobPtr BlobCache::Get(const std::shared_ptr<const CachedFile> &file,
+                                  int code, bool keepAlive,
+                                  codec::Encoding encoding) {
+  Key key = {file.get(), code, keepAlive, encoding};
+  Shard &shard = ShardOf_(key);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto it = shard.map.find(key);
+  if (it != shard.map.end()) {
+    if (it->second.src.lock() == file) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second.pos);
+      ++shard.hits;
+      return it->second.blob;
+    }
+    Erase_(shard, it);
+  }
+  ++shard.misses;
+  return nullptr;
+}
+
+BlobCache::BlobPtr BlobCache::Put(const std::shared_ptr<const CachedFile> &file,
+                                  int code, bool keepAlive,
+                                  codec::Encoding encoding,
+                                  std::string blob) {
+  BlobPtr ptr = std::make_shared<const std::string>(std::move(blob));
+  if (ptr->size() > shardBudget_) {
+    return ptr;
+  }
+  Key key = {file.get(), code, keepAlive, encoding};
+  Shard &shard = ShardOf_(key);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto it = shard.map.find(key);
+  if (it != shard.map.end()) {
+    Erase_(shard, it);
+  }
+  while (shard.bytes + ptr->size() > shardBudget_) {
+    Erase_(shard, shard.map.find(shard.lru.back()));
+  }
+  shard.lru.push_front(key);
+  shard.map.emplace(key, Node{file, ptr, shard.lru.begin()});
+  shard.bytes += ptr->size();
+  return ptr;
+}
+
+size_t BlobCache::Hits() {
+  size_t n = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    n += shard.hits;
+  }
+  return n;
+}
+
+size_t BlobCache::Misses() {
+  size_t n = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    n += shard.misses;
+  }
+  return n;
+}
+
+size_t BlobCache::Bytes() {
+  size_t n = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    n += shard.bytes;
+  }
+  return n;
+}
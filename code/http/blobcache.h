@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "filecache.h"
+
+// 小文件完整响应(状态行+头部+正文)的内存缓存，按文件缓存条目、状态码、
+// 是否keep-alive、内容编码区分。命中时响应只是一个引用计数的字符串，交给连接直接发送。
+// 文件改动后FileCache换成新条目，旧条目对应的响应自然失配，随LRU淘汰。
+// 总内存不超过budget，分片各自按LRU淘汰
+class BlobCache {
+public:
+  typedef std::shared_ptr<const std::string> BlobPtr;
+
+  static BlobCache *Instance();
+
+  // budget为0时关闭；只缓存不超过maxFileSize的文件
+  void Init(size_t budget, size_t maxFileSize);
+  bool Cacheable(const CachedFile &file) const;
+
+  BlobPtr Get(const std::shared_ptr<const CachedFile> &file, int code,
+              bool keepAlive, codec::Encoding encoding);
+  BlobPtr Put(const std::shared_ptr<const CachedFile> &file, int code,
+              bool keepAlive, codec::Encoding encoding, std::string blob);
+
+  size_t Hits();
+  size_t Misses();
+  size_t Bytes();
+
+private:
+  BlobCache();
+  ~BlobCache() = default;
+
+  struct Key {
+    const CachedFile *file;
+    int code;
+    bool keepAlive;
+    codec::Encoding encoding;
+    bool operator==(const Key &o) const {
+      return file == o.file && code == o.code && keepAlive == o.keepAlive &&
+             encoding == o.encoding;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      // 堆地址低位规律性强，乘法散列后再取高位混回低位
+      uint64_t h = reinterpret_cast<uintptr_t>(k.file) ^
+                   (static_cast<uint64_t>(k.code) << 3 |
+                    static_cast<uint64_t>(k.encoding) << 1 | k.keepAlive);
+      h *= 0x9E3779B97F4A7C15ull;
+      return static_cast<size_t>(h ^ (h >> 32));
+    }
+  };
+  // src用于确认key中的地址仍是同一个条目，没有被释放后复用
+  struct Node {
+    std::weak_ptr<const CachedFile> src;
+    BlobPtr blob;
+    std::list<Key>::iterator pos;
+  };
+  struct Shard {
+    std::mutex mtx;
+    std::unordered_map<Key, Node, KeyHash> map;
+    std::list<Key> lru;
+    size_t bytes = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  Shard &ShardOf_(const Key &key);
+  static void Erase_(Shard &shard,
+                     std::unordered_map<Key, Node, KeyHash>::iterator it);
+
+  static const size_t SHARD_NUM = 16;
+
+  size_t shardBudget_;
+  size_t maxFileSize_;
+  Shard shards_[SHARD_NUM];
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// 静态资源的gzip/brotli压缩与Accept-Encoding协商
+namespace codec {
+
+enum Encoding {
+  IDENTITY = 0,
+  GZIP,
+  BROTLI,
+  ENCODING_NUM,
+};
+
+// 按Accept-Encoding(含q值)选出客户端可接受的最优编码，同等时优先brotli
+Encoding Negotiate(std::string_view acceptEncoding);
+// 文本类资源才值得压缩
+bool Compressible(std::string_view mime);
+// Content-Encoding头中的名字
+const char *Name(Encoding enc);
+// 压缩失败返回false
+bool Encode(Encoding enc, const char *data, size_t len, std::string *out);
+
+} // namespace codec
@@ -0,0 +1,16 @@
+#include "connslab.h"
+
+ConnSlab::ConnSlab(size_t capacity)
+    : capacity_(capacity ? capacity : FdLimit()),
+      conns_(new HttpConn[capacity_]) {
+  assert(capacity_ > 0);
+}
+
+size_t ConnSlab::FdLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == RLIM_INFINITY ||
+      limit.rlim_cur > MAX_CAPACITY) {
+    return MAX_CAPACITY;
+  }
+  return static_cast<size_t>(limit.rlim_cur);
+}
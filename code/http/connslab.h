@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <sys/resource.h>
+
+#include "httpconn.h"
+
+// 以fd为下标、预先分配的连接表，容量取自RLIMIT_NOFILE
+// fd在进程内唯一，多个reactor可以共用一张表，各自只访问自己accept的fd
+class ConnSlab {
+public:
+  explicit ConnSlab(size_t capacity = 0);
+  ~ConnSlab() = default;
+
+  HttpConn *Get(int fd) {
+    assert(fd >= 0 && static_cast<size_t>(fd) < capacity_);
+    return &conns_[fd];
+  }
+  bool Contains(int fd) const {
+    return fd >= 0 && static_cast<size_t>(fd) < capacity_;
+  }
+  size_t Capacity() const { return capacity_; }
+
+  static size_t FdLimit();
+
+private:
+  static const size_t MAX_CAPACITY = 1 << 20;
+
+  size_t capacity_;
+  std::unique_ptr<HttpConn[]> conns_;
+};
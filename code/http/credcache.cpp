@@ -0,0 +1,137 @@
+#include "credcache.h"
+
+#include <cstring>
+#include <random>
+
+namespace {
+
+// 比较耗时与摘要内容无关
+bool DigestEqual(const uint8_t *a, const uint8_t *b, size_t len) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; ++i) {
+    diff |= a[i] ^ b[i];
+  }
+  return diff == 0;
+}
+
+} // namespace
+
+CredCache *CredCache::Instance() {
+  static CredCache cache;
+  return &cache;
+}
+
+CredCache::CredCache() : shardCap_(0), ttl_(0) {}
+
+void CredCache::Init(size_t capacity, int ttlMS) {
+  shardCap_ = (capacity + SHARD_NUM - 1) / SHARD_NUM;
+  ttl_ = std::chrono::milliseconds(ttlMS);
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.map.clear();
+    shard.lru.clear();
+  }
+}
+
+CredCache::Shard &CredCache::ShardOf_(const std::string &name) {
+  size_t h = std::hash<std::string>()(name);
+  return shards_[(h ^ (h >> 32)) % SHARD_NUM];
+}
+
+void CredCache::Digest_(const uint8_t *salt, const std::string &pwd,
+                        uint8_t *digest) {
+  std::string msg(reinterpret_cast<const char *>(salt), SALT_LEN);
+  msg += pwd;
+  SHA256(reinterpret_cast<const unsigned char *>(msg.data()), msg.size(),
+         digest);
+}
+
+// 摘要在锁外计算，锁内只拷贝盐和摘要
+CredCache::Result CredCache::Check(const std::string &name,
+                                   const std::string &pwd) {
+  if (shardCap_ == 0) {
+    return MISS;
+  }
+  uint8_t salt[SALT_LEN];
+  uint8_t expected[DIGEST_LEN];
+  Shard &shard = ShardOf_(name);
+  {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.map.find(name);
+    if (it == shard.map.end() || it->second.expire <= Clock::now()) {
+      ++shard.misses;
+      return MISS;
+    }
+    ++shard.hits;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.pos);
+    memcpy(salt, it->second.salt, SALT_LEN);
+    memcpy(expected, it->second.digest, DIGEST_LEN);
+  }
+  uint8_t digest[DIGEST_LEN];
+  Digest_(salt, pwd, digest);
+  return DigestEqual(digest, expected, DIGEST_LEN) ? MATCH : MISMATCH;
+}
+
+bool CredCache::Known(const std::string &name) {
+  if (shardCap_ == 0) {
+    return false;
+  }
+  Shard &shard = ShardOf_(name);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto it = shard.map.find(name);
+  if (it == shard.map.end()) {
+    return false;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second.pos);
+  return true;
+}
+
+void CredCache::Put(const std::string &name, const std::string &pwd) {
+  if (shardCap_ == 0) {
+    return;
+  }
+  // 每个条目独立的随机盐，相同密码的摘要也不同
+  thread_local std::mt19937_64 rng{std::random_device{}()};
+  Node node;
+  for (size_t i = 0; i < SALT_LEN; i += sizeof(uint64_t)) {
+    uint64_t r = rng();
+    memcpy(node.salt + i, &r, sizeof(r));
+  }
+  Digest_(node.salt, pwd, node.digest);
+  node.expire = Clock::now() + ttl_;
+
+  Shard &shard = ShardOf_(name);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto it = shard.map.find(name);
+  if (it != shard.map.end()) {
+    node.pos = it->second.pos;
+    shard.lru.splice(shard.lru.begin(), shard.lru, node.pos);
+    it->second = node;
+    return;
+  }
+  if (shard.map.size() >= shardCap_) {
+    shard.map.erase(shard.lru.back());
+    shard.lru.pop_back();
+  }
+  shard.lru.push_front(name);
+  node.pos = shard.lru.begin();
+  shard.map.emplace(name, node);
+}
+
+size_t CredCache::Hits() {
+  size_t n = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    n += shard.hits;
+  }
+  return n;
+}
+
+size_t CredCache::Misses() {
+  size_t n = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    n += shard.misses;
+  }
+  return n;
+}
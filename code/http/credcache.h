@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <openssl/sha.h>
+#include <string>
+#include <unordered_map>
+
+// 登录凭证的内存缓存，挡在数据库校验前面。只存加盐的SHA-256摘要，不存明文密码。
+// 摘要过了ttl后不再用于校验登录，但条目保留：用户不会被删除，
+// 已知存在的用户名可以直接拒绝注册。条目数不超过capacity，分片各自按LRU淘汰
+class CredCache {
+public:
+  enum Result {
+    MISS,     // 不在缓存或已过期，需要查数据库
+    MATCH,    // 密码正确
+    MISMATCH, // 密码错误
+  };
+
+  static CredCache *Instance();
+
+  // capacity为0时关闭
+  void Init(size_t capacity, int ttlMS);
+
+  Result Check(const std::string &name, const std::string &pwd);
+  // 用户名是否已知存在(不论摘要是否过期)，不计入命中统计
+  bool Known(const std::string &name);
+  // pwd为数据库中的密码，或刚注册成功的密码
+  void Put(const std::string &name, const std::string &pwd);
+
+  // 登录校验(Check)的命中和未命中次数
+  size_t Hits();
+  size_t Misses();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  static const size_t SALT_LEN = 16;
+  static const size_t DIGEST_LEN = SHA256_DIGEST_LENGTH;
+  static const size_t SHARD_NUM = 16;
+
+  struct Node {
+    uint8_t salt[SALT_LEN];
+    uint8_t digest[DIGEST_LEN];
+    Clock::time_point expire;
+    std::list<std::string>::iterator pos;
+  };
+  struct Shard {
+    std::mutex mtx;
+    std::unordered_map<std::string, Node> map;
+    std::list<std::string> lru;
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  CredCache();
+  ~CredCache() = default;
+
+  Shard &ShardOf_(const std::string &name);
+  static void Digest_(const uint8_t *salt, const std::string &pwd,
+                      uint8_t *digest);
+
+  size_t shardCap_;
+  Clock::duration ttl_;
+  Shard shards_[SHARD_NUM];
+};
@@ -0,0 +1,156 @@
+#include "delimscan.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DELIMSCAN_X86 1
+#endif
+
+namespace delimscan {
+
+namespace {
+
+ScanFunc Select() {
+  if (HasAvx2()) {
+    return ScanAvx2;
+  }
+  if (HasSse2()) {
+    return ScanSse2;
+  }
+  return ScanScalar;
+}
+
+const ScanFunc SCAN = Select();
+
+} // namespace
+
+void ScanScalar(const char *base, size_t nblocks, Block *out) {
+  for (size_t b = 0; b < nblocks; ++b) {
+    const char *p = base + b * 64;
+    Block blk = {0, 0, 0};
+    for (int i = 0; i < 64; ++i) {
+      uint64_t bit = 1ull << i;
+      blk.lf |= p[i] == '\n' ? bit : 0;
+      blk.colon |= p[i] == ':' ? bit : 0;
+      blk.space |= p[i] == ' ' ? bit : 0;
+    }
+    out[b] = blk;
+  }
+}
+
+#ifdef DELIMSCAN_X86
+
+__attribute__((target("sse2"))) void ScanSse2(const char *base,
+                                              size_t nblocks, Block *out) {
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i space = _mm_set1_epi8(' ');
+  for (size_t b = 0; b < nblocks; ++b) {
+    Block blk = {0, 0, 0};
+    for (int i = 0; i < 4; ++i) {
+      __m128i v = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(base + b * 64 + i * 16));
+      int shift = i * 16;
+      blk.lf |= static_cast<uint64_t>(static_cast<uint16_t>(
+                    _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf))))
+                << shift;
+      blk.colon |= static_cast<uint64_t>(static_cast<uint16_t>(
+                       _mm_movemask_epi8(_mm_cmpeq_epi8(v, colon))))
+                   << shift;
+      blk.space |= static_cast<uint64_t>(static_cast<uint16_t>(
+                       _mm_movemask_epi8(_mm_cmpeq_epi8(v, space))))
+                   << shift;
+    }
+    out[b] = blk;
+  }
+}
+
+__attribute__((target("avx2"))) static inline uint64_t
+Mask64(__m256i lo, __m256i hi, __m256i ch) {
+  uint32_t l =
+      static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, ch)));
+  uint32_t h =
+      static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, ch)));
+  return static_cast<uint64_t>(l) | (static_cast<uint64_t>(h) << 32);
+}
+
+__attribute__((target("avx2"))) void ScanAvx2(const char *base,
+                                              size_t nblocks, Block *out) {
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i space = _mm256_set1_epi8(' ');
+  for (size_t b = 0; b < nblocks; ++b) {
+    const char *p = base + b * 64;
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+    out[b] = {Mask64(lo, hi, lf), Mask64(lo, hi, colon), Mask64(lo, hi, space)};
+  }
+}
+
+// 可能在静态初始化期间调用，先确保CPU特性已探测
+bool HasSse2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+bool HasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+void ScanSse2(const char *base, size_t nblocks, Block *out) {
+  ScanScalar(base, nblocks, out);
+}
+
+void ScanAvx2(const char *base, size_t nblocks, Block *out) {
+  ScanScalar(base, nblocks, out);
+}
+
+bool HasSse2() { return false; }
+
+bool HasAvx2() { return false; }
+
+#endif
+
+void Scan(const char *base, size_t scanned, size_t end,
+          std::vector<Block> &blocks) {
+  // 上次的末块可能不完整，从它开始重扫
+  size_t first = scanned / 64;
+  size_t last = (end + 63) / 64;
+  if (first >= last) {
+    return;
+  }
+  if (blocks.size() < last) {
+    blocks.resize(last);
+  }
+  size_t full = end / 64;
+  if (full > first) {
+    SCAN(base + first * 64, full - first, &blocks[first]);
+  }
+  if (full < last) {
+    // 不足64字节的尾块拷到栈上再扫，避免越界读
+    char tail[64] = {0};
+    memcpy(tail, base + full * 64, end - full * 64);
+    SCAN(tail, 1, &blocks[full]);
+    uint64_t valid = RangeMask(0, end - full * 64);
+    blocks[full].lf &= valid;
+    blocks[full].colon &= valid;
+    blocks[full].space &= valid;
+  }
+}
+
+const char *ImplName() {
+  if (SCAN == ScanAvx2) {
+    return "avx2";
+  }
+  if (SCAN == ScanSse2) {
+    return "sse2";
+  }
+  return "scalar";
+}
+
+} // namespace delimscan
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 一遍扫描请求字节，为'\n'、':'、' '各生成一张位图(每64字节一个字)，
+// 解析器用ctz在位图上定位行尾和分隔符，不再逐字节比较。
+// 运行时按CPU选择AVX2/SSE2实现，其余平台用逐字节的标量实现
+namespace delimscan {
+
+struct Block {
+  uint64_t lf;
+  uint64_t colon;
+  uint64_t space;
+};
+
+typedef void (*ScanFunc)(const char *base, size_t nblocks, Block *out);
+
+// 更新base[0, end)对应的位图，[0, scanned)已扫描过的整块不再重扫。
+// blocks只增不缩，复用时不会反复清零
+void Scan(const char *base, size_t scanned, size_t end,
+          std::vector<Block> &blocks);
+
+// 块内[from, to)的位，0 <= from < to <= 64
+inline uint64_t RangeMask(size_t from, size_t to) {
+  uint64_t hi = to == 64 ? ~0ull : ((1ull << to) - 1);
+  return hi & (~0ull << from);
+}
+
+// 在位图中查找[from, to)内第一个置位的偏移，没有则返回to
+inline size_t FindNext(const std::vector<Block> &blocks, uint64_t Block::*mask,
+                       size_t from, size_t to) {
+  while (from < to) {
+    size_t b = from / 64;
+    size_t lim = std::min(to, b * 64 + 64);
+    uint64_t m = blocks[b].*mask & RangeMask(from % 64, lim - b * 64);
+    if (m) {
+      return b * 64 + __builtin_ctzll(m);
+    }
+    from = lim;
+  }
+  return to;
+}
+
+// [from, to)内置位的个数
+inline size_t Count(const std::vector<Block> &blocks, uint64_t Block::*mask,
+                    size_t from, size_t to) {
+  size_t n = 0;
+  while (from < to) {
+    size_t b = from / 64;
+    size_t lim = std::min(to, b * 64 + 64);
+    n += __builtin_popcountll(blocks[b].*mask &
+                              RangeMask(from % 64, lim - b * 64));
+    from = lim;
+  }
+  return n;
+}
+
+// 以下处理nblocks个完整的64字节块
+void ScanScalar(const char *base, size_t nblocks, Block *out);
+void ScanSse2(const char *base, size_t nblocks, Block *out);
+void ScanAvx2(const char *base, size_t nblocks, Block *out);
+
+bool HasSse2();
+bool HasAvx2();
+const char *ImplName();
+
+} // namespace delimscan
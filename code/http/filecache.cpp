@@ -0,0 +1,315 @@
+#include "filecache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "httpresponse.h"
+
+namespace {
+
+const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                            IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                            IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+} // namespace
+
+CachedFile::CachedFile()
+    : exists(false), readable(false), st(), fd(-1), data(nullptr) {}
+
+CachedFile::~CachedFile() {
+  if (data) {
+    munmap(data, st.st_size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+std::shared_ptr<const std::string>
+CachedFile::Variant(codec::Encoding enc) const {
+  if (enc == codec::IDENTITY || !readable || !S_ISREG(st.st_mode) ||
+      st.st_size == 0 || st.st_size > MAX_COMPRESS_SIZE ||
+      !codec::Compressible(mime)) {
+    return nullptr;
+  }
+  std::call_once(variantOnce_[enc],
+                 [this, enc] { variants_[enc] = Compress_(enc); });
+  return variants_[enc];
+}
+
+std::shared_ptr<const std::string>
+CachedFile::Compress_(codec::Encoding enc) const {
+  size_t size = st.st_size;
+  std::string raw;
+  const char *src = data;
+  if (!src) {
+    raw.resize(size);
+    for (size_t n = 0; n < size;) {
+      ssize_t len = pread(fd, &raw[n], size - n, n);
+      if (len <= 0) {
+        return nullptr;
+      }
+      n += len;
+    }
+    src = raw.data();
+  }
+  std::shared_ptr<std::string> out = std::make_shared<std::string>();
+  // 至少省下10%才值得多一份内存
+  if (!codec::Encode(enc, src, size, out.get()) ||
+      out->size() * 10 > size * 9) {
+    return nullptr;
+  }
+  out->shrink_to_fit();
+  return out;
+}
+
+FileCache *FileCache::Instance() {
+  static FileCache cache;
+  return &cache;
+}
+
+FileCache::FileCache()
+    : enabled_(false), shardCapacity_(0), inotifyFd_(-1), stopFd_(-1) {}
+
+FileCache::~FileCache() { Close(); }
+
+bool FileCache::Init(const std::string &root, size_t capacity) {
+  assert(capacity > 0);
+  Close();
+  shardCapacity_ = (capacity + SHARD_NUM - 1) / SHARD_NUM;
+  inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  stopFd_ = eventfd(0, EFD_CLOEXEC);
+  if (inotifyFd_ < 0 || stopFd_ < 0) {
+    LOG_WARN("FileCache: inotify unavailable, cache disabled");
+    Close();
+    return false;
+  }
+  AddWatch_(root);
+  if (dirs_.empty()) {
+    LOG_WARN("FileCache: cannot watch %s, cache disabled", root.c_str());
+    Close();
+    return false;
+  }
+  watcher_ = std::thread(&FileCache::Watch_, this);
+  enabled_ = true;
+  return true;
+}
+
+void FileCache::Close() {
+  enabled_ = false;
+  if (watcher_.joinable()) {
+    uint64_t one = 1;
+    if (write(stopFd_, &one, sizeof(one)) < 0) {
+      LOG_WARN("FileCache: stop watcher error");
+    }
+    watcher_.join();
+  }
+  if (inotifyFd_ >= 0) {
+    close(inotifyFd_);
+    inotifyFd_ = -1;
+  }
+  if (stopFd_ >= 0) {
+    close(stopFd_);
+    stopFd_ = -1;
+  }
+  dirs_.clear();
+  InvalidateAll_();
+}
+
+FileCache::Shard &FileCache::ShardOf_(const std::string &path) {
+  return shards_[std::hash<std::string>()(path) % SHARD_NUM];
+}
+
+std::shared_ptr<const CachedFile> FileCache::Get(const std::string &path) {
+  // 只缓存规范路径：带"."、".."或"//"的写法与inotify给出的路径对不上，
+  // 且可能指向根目录之外
+  if (!enabled_ || path.find("/.") != std::string::npos ||
+      path.find("//") != std::string::npos) {
+    return Load_(path);
+  }
+  Shard &shard = ShardOf_(path);
+  uint64_t gen;
+  {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.map.find(path);
+    if (it != shard.map.end()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second.pos);
+      ++shard.hits;
+      return it->second.file;
+    }
+    ++shard.misses;
+    gen = shard.gen;
+  }
+
+  FilePtr file = Load_(path);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  if (shard.gen != gen) {
+    return file;
+  }
+  auto ret = shard.map.emplace(path, Node{file, shard.lru.end()});
+  if (!ret.second) {
+    // 其他线程已加载同一路径
+    return ret.first->second.file;
+  }
+  shard.lru.push_front(&ret.first->first);
+  ret.first->second.pos = shard.lru.begin();
+  if (shard.map.size() > shardCapacity_) {
+    const std::string *victim = shard.lru.back();
+    shard.lru.pop_back();
+    shard.map.erase(*victim);
+  }
+  return file;
+}
+
+size_t FileCache::Hits() {
+  size_t n = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    n += shard.hits;
+  }
+  return n;
+}
+
+size_t FileCache::Misses() {
+  size_t n = 0;
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    n += shard.misses;
+  }
+  return n;
+}
+
+FileCache::FilePtr FileCache::Load_(const std::string &path) {
+  std::shared_ptr<CachedFile> file = std::make_shared<CachedFile>();
+  file->mime = HttpResponse::FileType(path);
+  file->cacheControl = HttpResponse::CacheControl(path);
+  if (stat(path.c_str(), &file->st) < 0) {
+    return file;
+  }
+  file->exists = true;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\"%lx-%lx\"",
+           static_cast<unsigned long>(file->st.st_mtime),
+           static_cast<unsigned long>(file->st.st_size));
+  file->etag = buf;
+  struct tm tm;
+  gmtime_r(&file->st.st_mtime, &tm);
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  file->lastModified = buf;
+  if (S_ISDIR(file->st.st_mode) || !(file->st.st_mode & S_IROTH)) {
+    return file;
+  }
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return file;
+  }
+  if (HttpResponse::useSendfile) {
+    file->fd = fd;
+  } else {
+    if (file->st.st_size > 0) {
+      void *mmRet = mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mmRet == MAP_FAILED) {
+        close(fd);
+        return file;
+      }
+      file->data = static_cast<char *>(mmRet);
+    }
+    close(fd);
+  }
+  file->readable = true;
+  return file;
+}
+
+void FileCache::Invalidate_(const std::string &path) {
+  Shard &shard = ShardOf_(path);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  ++shard.gen;
+  auto it = shard.map.find(path);
+  if (it != shard.map.end()) {
+    shard.lru.erase(it->second.pos);
+    shard.map.erase(it);
+  }
+}
+
+void FileCache::InvalidateAll_() {
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    ++shard.gen;
+    shard.map.clear();
+    shard.lru.clear();
+  }
+}
+
+// 递归监视dir及其所有子目录
+void FileCache::AddWatch_(const std::string &dir) {
+  int wd = inotify_add_watch(inotifyFd_, dir.c_str(), WATCH_MASK | IN_ONLYDIR);
+  if (wd < 0) {
+    LOG_WARN("FileCache: watch %s error", dir.c_str());
+    return;
+  }
+  dirs_[wd] = dir;
+  DIR *dp = opendir(dir.c_str());
+  if (!dp) {
+    return;
+  }
+  while (struct dirent *ent = readdir(dp)) {
+    if (ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 &&
+        strcmp(ent->d_name, "..") != 0) {
+      AddWatch_(dir + "/" + ent->d_name);
+    }
+  }
+  closedir(dp);
+}
+
+void FileCache::Watch_() {
+  alignas(struct inotify_event) char buf[4096];
+  struct pollfd fds[2] = {{inotifyFd_, POLLIN, 0}, {stopFd_, POLLIN, 0}};
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents) {
+      break;
+    }
+    ssize_t len = read(inotifyFd_, buf, sizeof(buf));
+    if (len <= 0) {
+      continue;
+    }
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *ev =
+          reinterpret_cast<const struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        InvalidateAll_();
+        continue;
+      }
+      auto it = dirs_.find(ev->wd);
+      if (it == dirs_.end()) {
+        continue;
+      }
+      if (ev->mask & IN_IGNORED) {
+        dirs_.erase(it);
+        continue;
+      }
+      // 目录本身增删、改名会影响其下所有路径，直接清空
+      if (ev->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) && ev->len) {
+          AddWatch_(it->second + "/" + ev->name);
+        }
+        InvalidateAll_();
+        continue;
+      }
+      if (ev->len) {
+        Invalidate_(it->second + "/" + ev->name);
+      }
+    }
+  }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
+
+#include "../log/log.h"
+#include "codec.h"
+
+// 一个静态文件的元数据和打开状态，加载后只读，多个响应共享
+struct CachedFile {
+  CachedFile();
+  ~CachedFile();
+  CachedFile(const CachedFile &) = delete;
+  CachedFile &operator=(const CachedFile &) = delete;
+
+  // 压缩后的正文，首次调用时生成并留在条目里，文件改动后随条目一起失效。
+  // 不可压缩、文件太大或压缩后没有明显变小时返回空
+  std::shared_ptr<const std::string> Variant(codec::Encoding enc) const;
+
+  bool exists;   // stat成功
+  bool readable; // 已打开(及映射)，可以发送
+  struct stat st;
+  int fd;     // sendfile模式下打开的fd
+  char *data; // mmap模式下的只读映射
+  std::string mime;
+  std::string cacheControl;
+  // 由stat结果生成的校验值，加载时算好
+  std::string etag;         // "mtime-size"，带引号的强校验值
+  std::string lastModified; // HTTP-date
+
+private:
+  std::shared_ptr<const std::string> Compress_(codec::Encoding enc) const;
+
+  static const off_t MAX_COMPRESS_SIZE = 4 << 20;
+
+  mutable std::once_flag variantOnce_[codec::ENCODING_NUM];
+  mutable std::shared_ptr<const std::string> variants_[codec::ENCODING_NUM];
+};
+
+// 静态资源的打开文件/元数据缓存，按完整路径索引，分片加锁供多线程共享。
+// 命中时不做文件系统调用；条目用shared_ptr引用计数，淘汰或失效后
+// 发送中的响应仍持有旧条目，最后一个引用释放时才close/munmap。
+// 失效由inotify监视根目录整棵树驱动，inotify不可用时不缓存
+class FileCache {
+public:
+  static FileCache *Instance();
+
+  bool Init(const std::string &root, size_t capacity = 1024);
+  void Close();
+  bool IsEnabled() const { return enabled_; }
+
+  std::shared_ptr<const CachedFile> Get(const std::string &path);
+  size_t Hits();
+  size_t Misses();
+
+private:
+  FileCache();
+  ~FileCache();
+
+  typedef std::shared_ptr<const CachedFile> FilePtr;
+  struct Node {
+    FilePtr file;
+    std::list<const std::string *>::iterator pos;
+  };
+  // 每片一把锁，lru队首为最近使用；gen在每次失效时递增，
+  // 加载期间发生过失效的结果不再放入缓存
+  struct Shard {
+    std::mutex mtx;
+    std::unordered_map<std::string, Node> map;
+    std::list<const std::string *> lru;
+    uint64_t gen = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  static FilePtr Load_(const std::string &path);
+  Shard &ShardOf_(const std::string &path);
+  void Invalidate_(const std::string &path);
+  void InvalidateAll_();
+  void AddWatch_(const std::string &dir);
+  void Watch_();
+
+  static const size_t SHARD_NUM = 16;
+
+  std::atomic<bool> enabled_;
+  size_t shardCapacity_;
+  Shard shards_[SHARD_NUM];
+
+  int inotifyFd_;
+  int stopFd_;
+  // wd -> 目录路径，只在Init和监视线程中访问
+  std::unordered_map<int, std::string> dirs_;
+  std::thread watcher_;
+};
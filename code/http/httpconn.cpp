@@ -5,26 +5,81 @@ const char *HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 
 HttpConn::HttpConn() {
+  static_assert(sizeof(HttpConn) == 64 && alignof(HttpConn) == 64,
+                "HttpConn hot record must be exactly one cache line");
+  static_assert(offsetof(HttpConn, fd_) == 0 &&
+                    offsetof(HttpConn, toWrite_) + sizeof(toWrite_) <= 64 &&
+                    offsetof(HttpConn, iov_) + sizeof(iov_) <= 64 &&
+                    offsetof(HttpConn, iovCnt_) + sizeof(iovCnt_) <= 64,
+                "per-event fields must stay in the hot record");
   fd_ = -1;
-  addr_ = {0};
   isClose_ = true;
+  isKeepAlive_ = false;
+  closing_ = false;
+  toWrite_ = 0;
+  phase_ = IDLE;
+  phaseStart_ = 0;
+  iov_ = nullptr;
+  iovCnt_ = 0;
+  sending_ = false;
 }
 HttpConn::~HttpConn() { Close(); }
 
+int64_t HttpConn::NowMS() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// 阶段变化时才读时钟，不随读写的字节数增加开销
+void HttpConn::UpdatePhase_(bool progress) {
+  Phase phase = IDLE;
+  if (toWrite_ > 0) {
+    phase = DRAIN;
+  } else if (NeedsDb()) {
+    phase = BACKEND;
+  } else if (cold_->request_.State() == HttpRequest::BODY) {
+    phase = BODY;
+  } else if (cold_->readBuff_.ReadableBytes() > 0) {
+    phase = HEADER;
+  }
+  if (phase != phase_.load(std::memory_order_relaxed) ||
+      (progress && phase == DRAIN)) {
+    phase_.store(phase, std::memory_order_relaxed);
+    phaseStart_.store(NowMS(), std::memory_order_relaxed);
+  }
+}
+
 void HttpConn::init(int fd, const sockaddr_in &addr) {
   assert(fd > 0);
+  if (!cold_) {
+    cold_.reset(new Cold());
+    iov_ = cold_->iovBuf_;
+  }
   ++userCount;
-  addr_ = addr;
+  cold_->addr_ = addr;
   fd_ = fd;
-  writeBuff_.RetrieveAll();
-  readBuff_.RetrieveAll();
+  isKeepAlive_ = false;
+  ClearOutput_();
+  cold_->readBuff_.RetrieveAll();
+  cold_->request_.Init();
+  cold_->dbRejected_ = false;
+  // 新连接还没发来请求，按等待头部计时
+  phase_ = HEADER;
+  phaseStart_ = NowMS();
+  closing_ = false;
+  sending_ = false;
   isClose_ = false;
   LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(),
            static_cast<int>(userCount));
 }
 
 void HttpConn::Close() {
-  response_.UnmapFile();
+  if (!cold_) {
+    return;
+  }
+  cold_->response_.ReleaseFile();
+  ClearOutput_();
   if (isClose_ == false) {
 
     isClose_ = true;
@@ -37,69 +92,268 @@ void HttpConn::Close() {
 
 int HttpConn::GetFd() const { return fd_; }
 
-struct sockaddr_in HttpConn::GetAddr() const { return addr_; }
-const char *HttpConn::GetIP() const { return inet_ntoa(addr_.sin_addr); }
-int HttpConn::GetPort() const { return addr_.sin_port; }
+const sockaddr_in &HttpConn::Addr_() const {
+  sockaddr_in &addr = cold_->addr_;
+  if (addr.sin_family == AF_UNSPEC) {
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd_, reinterpret_cast<struct sockaddr *>(&addr), &len) <
+        0) {
+      addr.sin_addr.s_addr = INADDR_ANY;
+      addr.sin_port = 0;
+    }
+    addr.sin_family = AF_INET;
+  }
+  return addr;
+}
+
+struct sockaddr_in HttpConn::GetAddr() const { return Addr_(); }
+const char *HttpConn::GetIP() const { return inet_ntoa(Addr_().sin_addr); }
+int HttpConn::GetPort() const { return Addr_().sin_port; }
 
 ssize_t HttpConn::read(int *saveErrno) {
   ssize_t len = -1;
   do {
-    len = readBuff_.ReadFd(fd_, saveErrno);
+    len = cold_->readBuff_.ReadFd(fd_, saveErrno);
     if (len <= 0)
       break;
   } while (isET);
+  UpdatePhase_();
+  return len;
+}
+
+ssize_t HttpConn::Receive(const char *data, ssize_t len, int *saveErrno) {
+  if (len > 0) {
+    cold_->readBuff_.Append(data, static_cast<size_t>(len));
+  } else if (len < 0) {
+    *saveErrno = static_cast<int>(-len);
+    len = -1;
+  }
+  UpdatePhase_();
   return len;
 }
 
 ssize_t HttpConn::write(int *saveErrno) {
   ssize_t len = -1;
+  bool progress = false;
   do {
-    len = writev(fd_, iov_, iovCnt_);
+    bool more = false;
+    if (BuildIov_(&more) > 0) {
+      struct msghdr msg = {};
+      msg.msg_iov = iov_;
+      msg.msg_iovlen = iovCnt_;
+      len = sendmsg(fd_, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    } else {
+      len = SendFile_();
+    }
     if (len <= 0) {
       *saveErrno = errno;
       break;
     }
-    if (iov_[0].iov_len + iov_[1].iov_len == 0) {
+    Consume_(len);
+    progress = true;
+    if (toWrite_ == 0) {
       break;
-    } else if (static_cast<size_t>(len) > iov_[0].iov_len) {
-      iov_[1].iov_base = (uint8_t *)iov_[1].iov_base + (len - iov_[0].iov_len);
-      iov_[1].iov_len -= (len - iov_[0].iov_len);
-      if (iov_[0].iov_len) {
-        writeBuff_.RetrieveAll();
-        iov_[0].iov_len = 0;
-      }
-    } else {
-      iov_[0].iov_base = (uint8_t *)iov_[0].iov_base + len;
-      iov_[0].iov_len -= len;
-      writeBuff_.Retrieve(len);
     }
-  } while (isET || ToWriteBytes() > 10240);
+  } while (isET || toWrite_ > 10240);
+  UpdatePhase_(progress);
   return len;
 }
 
-bool HttpConn::process() {
-  request_.Init();
-  if (readBuff_.ReadableBytes() <= 0) {
+bool HttpConn::PrepareSend(const struct msghdr **msg, int *flags) {
+  bool more = false;
+  if (toWrite_ == 0 || BuildIov_(&more) == 0) {
     return false;
+  }
+  struct msghdr &m = cold_->msg_;
+  m = {};
+  m.msg_iov = iov_;
+  m.msg_iovlen = iovCnt_;
+  *msg = &m;
+  *flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+  return true;
+}
 
-  } else if (request_.parse(readBuff_)) {
-    LOG_DEBUG("%s", request_.path().c_str());
-    response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+ssize_t HttpConn::SendDone(int res, int *saveErrno) {
+  sending_ = false;
+  if (res <= 0) {
+    // 有数据要发时sendmsg不会返回0
+    *saveErrno = res < 0 ? -res : EIO;
+    UpdatePhase_();
+    return -1;
+  }
+  Consume_(static_cast<size_t>(res));
+  UpdatePhase_(true);
+  return res;
+}
 
-  } else {
-    response_.Init(srcDir, request_.path(), false, 400);
+// 从队首开始为未发送的头部和映射正文生成iovec，最多MAX_IOV个，
+// 遇到需要sendfile的正文就停下，more表示其后紧跟sendfile
+int HttpConn::BuildIov_(bool *more) {
+  const std::vector<Segment> &out = cold_->out_;
+  const char *head = cold_->writeBuff_.Peek();
+  iovCnt_ = 0;
+  for (size_t i = cold_->outHead_; i < out.size() && iovCnt_ + 2 <= MAX_IOV;
+       ++i) {
+    const Segment &seg = out[i];
+    if (seg.headLen) {
+      iov_[iovCnt_++] = {const_cast<char *>(head), seg.headLen};
+      head += seg.headLen;
+    }
+    if (seg.bodyOff < seg.bodyEnd) {
+      if (seg.file && seg.file->fd >= 0) {
+        *more = iovCnt_ > 0;
+        break;
+      }
+      const char *body = seg.blob ? seg.blob->data() : seg.file->data;
+      iov_[iovCnt_++] = {const_cast<char *>(body) + seg.bodyOff,
+                         seg.bodyEnd - seg.bodyOff};
+    }
   }
-  response_.MakeResponse(writeBuff_);
-  iov_[0].iov_base = const_cast<char *>(writeBuff_.Peek());
-  iov_[0].iov_len = writeBuff_.ReadableBytes();
-  iovCnt_ = 1;
+  return iovCnt_;
+}
 
-  if (response_.FileLen() > 0 && response_.File()) {
-    iov_[1].iov_base = response_.File();
-    iov_[1].iov_len = response_.FileLen();
-    iovCnt_ = 2;
+// 队首响应的头部已发完，用sendfile发送其正文
+ssize_t HttpConn::SendFile_() {
+  const Segment &seg = cold_->out_[cold_->outHead_];
+  assert(seg.headLen == 0 && seg.file && seg.file->fd >= 0);
+  // fd由多个连接共享，用显式偏移，不动文件位置
+  off_t off = static_cast<off_t>(seg.bodyOff);
+  ssize_t len = sendfile(fd_, seg.file->fd, &off, seg.bodyEnd - seg.bodyOff);
+  if (len == 0) {
+    // 文件在发送途中被截短，剩下的字节永远发不出去
+    errno = EIO;
+    return -1;
   }
-  LOG_DEBUG("filesize:%d, %d to %d", response_.FileLen(), iovCnt_,
-            ToWriteBytes());
-  return true;
+  return len;
+}
+
+void HttpConn::Consume_(size_t len) {
+  std::vector<Segment> &out = cold_->out_;
+  size_t &outHead = cold_->outHead_;
+  toWrite_ -= len;
+  while (outHead < out.size()) {
+    Segment &seg = out[outHead];
+    size_t n = std::min(len, seg.headLen);
+    cold_->writeBuff_.Retrieve(n);
+    seg.headLen -= n;
+    len -= n;
+    n = std::min(len, seg.bodyEnd - seg.bodyOff);
+    seg.bodyOff += n;
+    len -= n;
+    if (seg.headLen || seg.bodyOff < seg.bodyEnd) {
+      break;
+    }
+    seg.file.reset();
+    seg.blob.reset();
+    ++outHead;
+  }
+  if (outHead == out.size()) {
+    out.clear();
+    outHead = 0;
+  }
+}
+
+void HttpConn::ClearOutput_() {
+  cold_->out_.clear();
+  cold_->outHead_ = 0;
+  cold_->writeBuff_.RetrieveAll();
+  toWrite_ = 0;
+}
+
+// 把刚生成的响应挂到发送队列尾部，正文的引用交给队列
+void HttpConn::QueueResponse_(const HttpRequest *request) {
+  HttpResponse &response = cold_->response_;
+  Buffer &writeBuff = cold_->writeBuff_;
+  size_t before = writeBuff.ReadableBytes();
+  response.MakeResponse(writeBuff, request);
+  for (const HttpResponse::Part &part : response.Parts()) {
+    size_t off = static_cast<size_t>(part.off);
+    PushSegment_({part.headEnd - before, response.File(), nullptr, off,
+                  off + part.len});
+    before = part.headEnd;
+  }
+  Segment seg = {writeBuff.ReadableBytes() - before, nullptr, nullptr, 0, 0};
+  if (!response.Parts().empty()) {
+    // multipart的结束分隔，单段时为空
+    if (seg.headLen) {
+      PushSegment_(std::move(seg));
+    }
+    response.ReleaseFile();
+    return;
+  }
+  if (response.Blob()) {
+    seg.blob = response.Blob();
+    seg.bodyEnd = seg.blob->size();
+  } else if (response.FileLen() > 0) {
+    seg.file = response.File();
+    seg.bodyEnd = response.FileLen();
+  }
+  response.ReleaseFile();
+  PushSegment_(std::move(seg));
+}
+
+void HttpConn::PushSegment_(Segment seg) {
+  toWrite_ += seg.headLen + (seg.bodyEnd - seg.bodyOff);
+  cold_->out_.push_back(std::move(seg));
+}
+
+bool HttpConn::process() {
+  HttpRequest &request = cold_->request_;
+  HttpResponse &response = cold_->response_;
+  Buffer &readBuff = cold_->readBuff_;
+
+  size_t queued = 0;
+  while (queued < MAX_PIPELINE && readBuff.ReadableBytes() > 0) {
+    HttpRequest::PARSE_RESULT ret = request.parse(readBuff);
+    if (ret == HttpRequest::INCOMPLETE) {
+      break;
+    } else if (ret == HttpRequest::COMPLETE) {
+      // 请求留在缓冲区里，数据库校验完成后再次parse直接得到COMPLETE；
+      // 凭证缓存命中或用户存储在本进程内时就地得出结果
+      if (request.NeedsDb() && !request.TryInlineDb()) {
+        break;
+      }
+      LOG_DEBUG("%s", request.path().c_str());
+      isKeepAlive_ = request.IsKeepAlive();
+      response.Init(srcDir, request.path(), isKeepAlive_,
+                    cold_->dbRejected_ ? 503 : 200);
+      cold_->dbRejected_ = false;
+      // 请求头指向读缓冲区，生成响应后再回收
+      QueueResponse_(&request);
+      readBuff.Retrieve(request.RequestBytes());
+    } else {
+      isKeepAlive_ = false;
+      response.Init(srcDir, request.path(), false, 400);
+      QueueResponse_(nullptr);
+      readBuff.RetrieveAll();
+    }
+    request.Init();
+    ++queued;
+    // 响应后要关闭连接，后面的请求不再处理
+    if (!isKeepAlive_) {
+      break;
+    }
+  }
+  LOG_DEBUG("queued %zu responses, %zu bytes to write", queued, toWrite_);
+  UpdatePhase_();
+  return toWrite_ > 0;
+}
+
+bool HttpConn::NeedsDb() const {
+  const HttpRequest &request = cold_->request_;
+  return request.State() == HttpRequest::FINISH && request.NeedsDb();
+}
+
+bool HttpConn::StartDb(std::function<void()> done) {
+  assert(NeedsDb());
+  return cold_->request_.HandleDb([this, done](bool busy) {
+    cold_->dbRejected_ = busy;
+    done();
+  });
+}
+
+void HttpConn::RejectDb() {
+  assert(NeedsDb());
+  cold_->request_.SkipDb();
+  cold_->dbRejected_ = true;
 }
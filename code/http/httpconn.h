@@ -1,52 +1,146 @@
 #pragma once
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
 #include <bits/types/struct_iovec.h>
 #include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <fcntl.h>
+#include <functional>
+#include <memory>
 #include <netinet/in.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <vector>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
 #include "httprequest.h"
 #include "httpresponse.h"
 
-class HttpConn {
+// 按fd下标存放在ConnSlab里，每次事件都要访问的字段(fd、状态、阶段、待写字节数、
+// 本次发送的iovec)正好占一条cache line，定时器也按同一个下标(fd)索引；
+// 缓冲区、解析器、响应等重的状态放在Cold里单独分配，首次使用时创建并复用。
+// 支持HTTP/1.1流水线：process一次解析读缓冲区里所有完整的请求，
+// 响应按顺序排队，write用一次sendmsg把多个响应的头部和映射的文件一起发出；
+// sendfile模式下文件正文从fd直接sendfile，前面的头部带MSG_MORE合并成包
+class alignas(64) HttpConn {
 public:
+  // 连接当前所处的阶段，各阶段有独立的超时。
+  // HEADER/BODY从阶段开始计时，不因收到数据顺延；DRAIN在每次写出数据后重新计时
+  enum Phase {
+    IDLE,    // keep-alive空闲，没有未完成的请求
+    HEADER,  // 等待请求行和头部收齐
+    BODY,    // 头部已完整，等待请求体收齐
+    DRAIN,   // 响应还没写完
+    BACKEND, // 请求在等数据库查询结果，期间不按超时关闭
+    PHASE_NUM,
+  };
+
   HttpConn();
   ~HttpConn();
 
+  // addr.sin_family为AF_UNSPEC时对端地址在用到时才用getpeername取
   void init(int fd, const sockaddr_in &addr);
   ssize_t read(int *saveErrno);
+  // io_uring已经收到的数据，len为recv的结果，返回值同read
+  ssize_t Receive(const char *data, ssize_t len, int *saveErrno);
   ssize_t write(int *saveErrno);
+  // 异步发送(io_uring)：PrepareSend生成这一次要发的msghdr，队首的正文要用
+  // sendfile时返回false，改用write。提交后到SendDone之前不能再生成响应或关闭，
+  // SendDone的res为sendmsg的结果，返回值同write
+  bool PrepareSend(const struct msghdr **msg, int *flags);
+  void MarkSending() { sending_ = true; }
+  bool IsSending() const { return sending_; }
+  ssize_t SendDone(int res, int *saveErrno);
   void Close();
   int GetFd() const;
   int GetPort() const;
   const char *GetIP() const;
   sockaddr_in GetAddr() const;
   bool process();
+  // 读缓冲区队首的请求已解析完，等待数据库校验；process在此停下
+  bool NeedsDb() const;
+  // 提交数据库校验，完成后调用done，由done安排再次process生成响应；
+  // 等连接超时的请求回503。查询排队已满时返回false
+  bool StartDb(std::function<void()> done);
+  // 查询排队已满，这个请求回503
+  void RejectDb();
+
+  size_t ToWriteBytes() const { return toWrite_; }
+  bool IsKeepAlive() const { return isKeepAlive_; }
+  bool IsClosed() const { return isClose_; }
+  // 不能马上关闭(在其他线程发起，或发送还没完成)时先打标记，
+  // 由reactor线程稍后真正关闭；已标记过返回false
+  bool MarkClosing() { return !closing_.exchange(true); }
+  bool IsClosing() const { return closing_.load(std::memory_order_relaxed); }
+  // 阶段只在read/process/write结束时更新，处理线程写、reactor线程读
+  Phase GetPhase() const { return static_cast<Phase>(phase_.load()); }
+  int64_t PhaseStartMS() const { return phaseStart_.load(); }
 
-  int ToWriteBytes() { return iov_[0].iov_len + iov_[1].iov_len; }
-  bool IsKeepAlive() const { return request_.IsKeepAlive(); }
+  // 单调时钟的毫秒数
+  static int64_t NowMS();
 
   static bool isET;
   static const char *srcDir;
   static std::atomic<int> userCount;
 
 private:
+  // 一个待发送的响应：头部在writeBuff_中按顺序连续存放，
+  // 正文引用文件缓存条目(映射或fd)的[bodyOff, bodyEnd)或缓存的blob，
+  // 发送完才释放；Range请求的每一段各占一个Segment
+  struct Segment {
+    size_t headLen;
+    std::shared_ptr<const CachedFile> file;
+    BlobCache::BlobPtr blob;
+    size_t bodyOff; // 正文当前发送位置
+    size_t bodyEnd;
+  };
+
+  // 一次process最多排队的响应数，剩下的请求等这批发完再处理
+  static const size_t MAX_PIPELINE = 64;
+  static const int MAX_IOV = IOV_MAX < 2 * MAX_PIPELINE ? IOV_MAX
+                                                         : 2 * MAX_PIPELINE;
+
+  struct Cold {
+    struct sockaddr_in addr_;
+    Buffer readBuff_;
+    Buffer writeBuff_;
+    HttpRequest request_;
+    HttpResponse response_;
+    std::vector<Segment> out_;
+    size_t outHead_ = 0;
+    struct iovec iovBuf_[MAX_IOV]; // hot record里的iov_指向这里
+    struct msghdr msg_;            // 异步发送期间由内核读取
+    bool dbRejected_ = false;
+  };
+
+  void QueueResponse_(const HttpRequest *request);
+  void PushSegment_(Segment seg);
+  int BuildIov_(bool *more);
+  ssize_t SendFile_();
+  void Consume_(size_t len);
+  void ClearOutput_();
+  void UpdatePhase_(bool progress = false);
+  const sockaddr_in &Addr_() const;
+
+  // hot record，布局由构造函数里的static_assert固定在一条cache line内
   int fd_;
-  struct sockaddr_in addr_;
+  std::atomic<uint8_t> phase_;
   bool isClose_;
+  bool isKeepAlive_;
+  std::atomic<bool> closing_;
+  size_t toWrite_;
+  std::atomic<int64_t> phaseStart_;
+  struct iovec *iov_; // BuildIov_生成的iovec，前iovCnt_个有效
   int iovCnt_;
-  struct iovec iov_[2];
-
-  Buffer readBuff_;
-  Buffer writeBuff_;
-
-  HttpRequest request_;
-  HttpResponse response_;
+  bool sending_; // 异步发送还没完成
+  std::unique_ptr<Cold> cold_;
 };
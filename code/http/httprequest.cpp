@@ -1,88 +1,171 @@
 #include "httprequest.h"
 
+AuthBackend *HttpRequest::auth = nullptr;
+
 const std::unordered_set<std::string> HttpRequest::DEFAULT_HTML{
     "/index", "/register", "/login", "/welcome", "/video", "/picture",
 };
 
-const std::unordered_map<std::string, int> DEFAULT_HTML_TAG{
+const std::unordered_map<std::string, int> HttpRequest::DEFAULT_HTML_TAG{
     {"/login.html", 1},
     {"/register.html", 0},
 };
 
 void HttpRequest::Init() {
   state_ = REQUEST_LINE;
-  method_ = path_ = version_ = body_ = "";
+  pos_ = bodyLen_ = 0;
+  scanned_ = 0;
+  base_ = nullptr;
+  method_ = version_ = {0, 0};
+  path_.clear();
+  body_.clear();
   header_.clear();
   post_.clear();
+  dbTag_ = -1;
 }
 
-bool HttpRequest::parse(Buffer &buff) {
-  const char END[] = "\r\n";
-  if (buff.ReadableBytes() == 0) {
-    return false;
+namespace {
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+bool IsOWS(char ch) { return ch == ' ' || ch == '\t'; }
+
+} // namespace
+
+HttpRequest::PARSE_RESULT HttpRequest::parse(const Buffer &buff) {
+  const char *base = buff.Peek();
+  size_t n = buff.ReadableBytes();
+  base_ = base;
+  if ((state_ == REQUEST_LINE || state_ == HEADERS) && scanned_ < n) {
+    // 新到的字节只扫描一遍，得到分隔符位图
+    size_t limit = std::min(n, MAX_HEADER_BYTES);
+    delimscan::Scan(base, scanned_, limit, delims_);
+    scanned_ = limit;
   }
-  while (buff.ReadableBytes() && state_ != FINISH) {
-    const char *lineend =
-        std::search(buff.Peek(), buff.BeginWriteConst(), END, END + 2);
-    std::string line(buff.Peek(), lineend);
+  using delimscan::Block;
+  while (state_ != FINISH) {
+    if (state_ == BODY) {
+      if (n - pos_ < bodyLen_) {
+        return INCOMPLETE;
+      }
+      ParseBody_(base);
+      break;
+    }
+    size_t lineEnd = delimscan::FindNext(delims_, &Block::lf, pos_, scanned_);
+    if (lineEnd == scanned_) {
+      if (n > MAX_HEADER_BYTES) {
+        LOG_ERROR("Request header too large");
+        return BAD_REQUEST;
+      }
+      return INCOMPLETE;
+    }
+    size_t begin = pos_;
+    size_t end = lineEnd;
+    pos_ = end + 1;
+    if (end > begin && base[end - 1] == '\r') {
+      --end;
+    }
     switch (state_) {
     case REQUEST_LINE:
-      if (!ParseRequestLine_(line))
-        return false;
+      if (begin == end) // 请求行前允许有空行
+        break;
+      if (!ParseRequestLine_(base, begin, end))
+        return BAD_REQUEST;
       ParsePath_();
       break;
     case HEADERS:
-      ParseHeader_(line);
-      if (buff.ReadableBytes() <= 2) // get请求，后为\r\n
-        state_ = FINISH;
-      break;
-    case BODY:
-      ParseBody_(line);
+      if (begin == end) {
+        if (!ParseHeadersEnd_(base))
+          return BAD_REQUEST;
+      } else if (!ParseHeader_(base, begin, end)) {
+        return BAD_REQUEST;
+      }
       break;
     default:
       break;
     }
-    if (lineend == buff.BeginWrite()) {
+  }
+  LOG_DEBUG("[%.*s], [%s], [%.*s]", static_cast<int>(method_.len),
+            base_ + method_.off, path_.c_str(), static_cast<int>(version_.len),
+            base_ + version_.off);
+  return COMPLETE;
+}
 
-      buff.RetrieveAll();
-      break;
-    }
-    buff.RetrieveUntil(lineend + 2);
+bool HttpRequest::ParseRequestLine_(const char *base, size_t begin,
+                                    size_t end) {
+  // METHOD SP request-target SP HTTP/version
+  using delimscan::Block;
+  size_t sp1 = delimscan::FindNext(delims_, &Block::space, begin, end);
+  size_t sp2 = delimscan::FindNext(delims_, &Block::space, sp1 + 1, end);
+  if (sp2 >= end || delimscan::Count(delims_, &Block::space, begin, end) != 2 ||
+      sp1 == begin || sp2 == sp1 + 1 || end - sp2 <= 6 ||
+      memcmp(base + sp2 + 1, "HTTP/", 5) != 0) {
+    LOG_ERROR("RequestLine_ Error");
+    return false;
   }
-  LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(),
-            version_.c_str());
+  method_ = {static_cast<uint32_t>(begin), static_cast<uint32_t>(sp1 - begin)};
+  version_ = {static_cast<uint32_t>(sp2 + 6),
+              static_cast<uint32_t>(end - (sp2 + 6))};
+  path_.assign(base + sp1 + 1, sp2 - sp1 - 1);
+  state_ = HEADERS;
   return true;
 }
 
-bool HttpRequest::ParseRequestLine_(const std::string &line) {
-  std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-  std::smatch Match;
-  if (std::regex_match(line, Match, patten)) {
-    method_ = Match[1];
-    path_ = Match[2];
-    version_ = Match[3];
-    state_ = HEADERS;
-    return true;
+bool HttpRequest::ParseHeader_(const char *base, size_t begin, size_t end) {
+  size_t colon =
+      delimscan::FindNext(delims_, &delimscan::Block::colon, begin, end);
+  if (colon >= end || colon == begin) {
+    LOG_ERROR("Header_ Error");
+    return false;
+  }
+  size_t valBegin = colon + 1;
+  size_t valEnd = end;
+  while (valBegin < valEnd && IsOWS(base[valBegin])) {
+    ++valBegin;
+  }
+  while (valEnd > valBegin && IsOWS(base[valEnd - 1])) {
+    --valEnd;
   }
-  LOG_ERROR("RequestLine_ Error");
-  return false;
+  header_.push_back(
+      {{static_cast<uint32_t>(begin), static_cast<uint32_t>(colon - begin)},
+       {static_cast<uint32_t>(valBegin),
+        static_cast<uint32_t>(valEnd - valBegin)}});
+  return true;
 }
 
-void HttpRequest::ParseHeader_(const std::string &line) {
-  std::regex patten("^([^:]*) ?(.*)$");
-  std::smatch Match;
-  if (std::regex_match(line, Match, patten)) {
-    header_[Match[1]] = Match[2];
-  } else {
-    state_ = BODY;
+bool HttpRequest::ParseHeadersEnd_(const char *base) {
+  assert(base == base_);
+  // 不支持分块传输，请求体长度只认Content-Length
+  if (!GetHeader("Transfer-Encoding").empty()) {
+    LOG_ERROR("Transfer-Encoding not supported");
+    return false;
   }
+  std::string_view cl = GetHeader("Content-Length");
+  size_t len = 0;
+  for (char ch : cl) {
+    if (ch < '0' || ch > '9') {
+      LOG_ERROR("Content-Length Error");
+      return false;
+    }
+    len = len * 10 + (ch - '0');
+    if (len > MAX_BODY_BYTES) {
+      LOG_ERROR("Request body too large");
+      return false;
+    }
+  }
+  bodyLen_ = len;
+  state_ = bodyLen_ ? BODY : FINISH;
+  return true;
 }
 
-void HttpRequest::ParseBody_(const std::string &line) {
-  body_ = line;
+void HttpRequest::ParseBody_(const char *base) {
+  body_.assign(base + pos_, bodyLen_);
+  pos_ += bodyLen_;
   ParsePost_();
   state_ = FINISH;
-  LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+  LOG_DEBUG("Body len:%zu", body_.size());
 }
 
 void HttpRequest::ParsePath_() {
@@ -106,25 +189,51 @@ int HttpRequest::ConvertHex(char ch) {
 }
 
 void HttpRequest::ParsePost_() {
-  if (method_ == "POST" &&
-      header_["Content-Type"] == "application/x-www-form-urlencoded") {
+  const std::string_view form = "application/x-www-form-urlencoded";
+  if (method() == "POST" &&
+      GetHeader("Content-Type").substr(0, form.size()) == form) {
     ParseFromUrlencoded_();
     if (DEFAULT_HTML_TAG.count(path_)) {
       int tag = DEFAULT_HTML_TAG.find(path_)->second;
       LOG_DEBUG("Tag:%d", tag);
       if (tag == 0 || tag == 1) {
-        bool isLogin = (tag == 1);
-        if (UserVerify(post_["username"], post_["password"], isLogin)) {
-          path_ = "/welcome.html";
-
-        } else {
-          path_ = "/error.html";
-        }
+        dbTag_ = tag;
       }
     }
   }
 }
 
+// 查询完成前dbTag_保持不变，连接按BACKEND阶段计时，process也停在这个请求上
+bool HttpRequest::HandleDb(std::function<void(bool busy)> done) {
+  assert(dbTag_ >= 0);
+  return UserVerify(post_["username"], post_["password"], dbTag_ == 1,
+                    [this, done](VERIFY_RESULT res) {
+                      if (res != VERIFY_BUSY) {
+                        path_ = res == VERIFY_OK ? "/welcome.html"
+                                                 : "/error.html";
+                      }
+                      dbTag_ = -1;
+                      done(res == VERIFY_BUSY);
+                    });
+}
+
+bool HttpRequest::TryInlineDb() {
+  assert(dbTag_ >= 0);
+  const std::string &name = post_["username"];
+  const std::string &pwd = post_["password"];
+  bool isLogin = dbTag_ == 1;
+  bool ok = false;
+  if (auth->IsInline()) {
+    UserVerify(name, pwd, isLogin,
+               [&ok](VERIFY_RESULT res) { ok = res == VERIFY_OK; });
+  } else if (!CachedVerify_(name, pwd, isLogin, &ok)) {
+    return false;
+  }
+  path_ = ok ? "/welcome.html" : "/error.html";
+  dbTag_ = -1;
+  return true;
+}
+
 void HttpRequest::ParseFromUrlencoded_() {
   if (body_.size() == 0)
     return;
@@ -166,80 +275,100 @@ void HttpRequest::ParseFromUrlencoded_() {
   }
 }
 
-bool HttpRequest::UserVerify(const std::string &name, const std::string &pwd,
-                             bool isLogin) {
+// 空用户名或密码直接失败；登录看缓存的摘要，注册时用户名已知存在就拒绝
+bool HttpRequest::CachedVerify_(const std::string &name, const std::string &pwd,
+                                bool isLogin, bool *ok) {
   if (name == "" || pwd == "") {
-    return false;
+    *ok = false;
+    return true;
   }
-  LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-
-  MYSQL *sql;
-  SqlConnRAII sqlConnRAII = SqlConnRAII(&sql, SqlConnPool::Instance());
-  assert(sql);
-
-  bool flag = false;
-  // unsigned num_fields = 0;
-  char order[256] = {0};
-  // MYSQL_FIELD *fields = nullptr;
-  MYSQL_RES *res = nullptr;
-
+  CredCache *cache = CredCache::Instance();
   if (!isLogin) {
-    flag = true;
+    if (!cache->Known(name)) {
+      return false;
+    }
+    LOG_INFO("user used!");
+    *ok = false;
+    return true;
   }
-  snprintf(order, 256,
-           "SELECT username, password FROM user WHERE username='%s' LIMIT 1",
-           name.c_str());
-  LOG_DEBUG("%s", order);
-
-  if (mysql_query(sql, order)) {
-    mysql_free_result(res);
+  CredCache::Result res = cache->Check(name, pwd);
+  if (res == CredCache::MISS) {
     return false;
   }
-  res = mysql_store_result(sql);
-  // num_fields = mysql_num_fields(res);
-  // fields = mysql_fetch_fields(res);
-
-  while (MYSQL_ROW row = mysql_fetch_row(res)) {
-    LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-    std::string password(row[1]);
-    if (isLogin) {
-      if (pwd == password) {
-        flag = true;
-      } else {
-        flag = false;
-      }
-      LOG_INFO("pwd error!");
+  *ok = res == CredCache::MATCH;
+  return true;
+}
 
-    } else {
-      flag = false;
-      LOG_INFO("user used!");
-    }
+// 先查用户名，注册时不存在再插入。查到的密码放进凭证缓存，
+// 后端在本进程内时查找比算摘要还快，不经过缓存
+bool HttpRequest::UserVerify(const std::string &name, const std::string &pwd,
+                             bool isLogin,
+                             std::function<void(VERIFY_RESULT)> done) {
+  if (name == "" || pwd == "") {
+    done(VERIFY_FAIL);
+    return true;
   }
+  LOG_INFO("Verify name:%s", name.c_str());
 
-  if (!isLogin && flag == true) {
+  AuthBackend *backend = auth;
+  bool useCache = !backend->IsInline();
+  return backend->Lookup(name, [=](const AuthBackend::Result &res) {
+    if (res.status == AuthBackend::BUSY) {
+      done(VERIFY_BUSY);
+      return;
+    }
+    if (res.status == AuthBackend::OK) {
+      if (useCache) {
+        CredCache::Instance()->Put(name, res.password);
+      }
+      if (isLogin && pwd == res.password) {
+        LOG_DEBUG("UserVerify success!");
+        done(VERIFY_OK);
+      } else {
+        LOG_INFO("%s", isLogin ? "pwd error!" : "user used!");
+        done(VERIFY_FAIL);
+      }
+      return;
+    }
+    if (isLogin || res.status != AuthBackend::NOT_FOUND) {
+      done(VERIFY_FAIL);
+      return;
+    }
     LOG_DEBUG("register!");
-    std::memset(order, '\0', 256);
-    snprintf(order, 256,
-             "INSERT INTO user(username, password) VALUES('%s','%s')",
-             name.c_str(), pwd.c_str());
-    LOG_DEBUG("%s", order);
-    if (mysql_query(sql, order)) {
-      LOG_DEBUG("Inset error!");
-      flag = false;
+    bool queued = backend->Insert(
+        name, pwd, [=](const AuthBackend::Result &ins) {
+          if (ins.status == AuthBackend::OK) {
+            if (useCache) {
+              CredCache::Instance()->Put(name, pwd);
+            }
+            done(VERIFY_OK);
+            return;
+          }
+          LOG_DEBUG("Insert error!");
+          done(ins.status == AuthBackend::BUSY ? VERIFY_BUSY : VERIFY_FAIL);
+        });
+    if (!queued) {
+      done(VERIFY_BUSY);
     }
-    flag = true;
-  }
-  LOG_DEBUG("UserVerify success!");
-  return flag;
+  });
 }
 
 std::string HttpRequest::path() const { return path_; }
 
 std::string &HttpRequest::path() { return path_; }
 
-std::string HttpRequest::method() const { return method_; }
+std::string_view HttpRequest::method() const { return View_(method_); }
+
+std::string_view HttpRequest::version() const { return View_(version_); }
 
-std::string HttpRequest::version() const { return version_; }
+std::string_view HttpRequest::GetHeader(std::string_view key) const {
+  for (const Field &field : header_) {
+    if (EqualsIgnoreCase(View_(field.key), key)) {
+      return View_(field.value);
+    }
+  }
+  return std::string_view();
+}
 
 std::string HttpRequest::GetPost(const std::string &key) const {
   assert(key != "");
@@ -258,9 +387,48 @@ std::string HttpRequest::GetPost(const char *key) const {
 }
 
 bool HttpRequest::IsKeepAlive() const {
-  if (header_.count("Connection") == 1) {
-    return header_.find("Connection")->second == "keep-alive" &&
-           version_ == "1.1";
+  std::string_view conn = GetHeader("Connection");
+  if (version() == "1.1") {
+    return !EqualsIgnoreCase(conn, "close");
+  }
+  return EqualsIgnoreCase(conn, "keep-alive");
+}
+
+bool HttpRequest::NotModified(std::string_view etag, time_t mtime) const {
+  if (method() != "GET" && method() != "HEAD") {
+    return false;
+  }
+  std::string_view inm = GetHeader("If-None-Match");
+  if (!inm.empty()) {
+    // 逗号分隔的列表，按弱比较忽略W/前缀
+    while (!inm.empty()) {
+      size_t comma = inm.find(',');
+      std::string_view tag = inm.substr(0, comma);
+      while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) {
+        tag.remove_prefix(1);
+      }
+      while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) {
+        tag.remove_suffix(1);
+      }
+      if (tag.substr(0, 2) == "W/") {
+        tag.remove_prefix(2);
+      }
+      if (tag == "*" || tag == etag) {
+        return true;
+      }
+      if (comma == std::string_view::npos) {
+        break;
+      }
+      inm.remove_prefix(comma + 1);
+    }
+    return false;
+  }
+  std::string_view ims = GetHeader("If-Modified-Since");
+  if (ims.empty()) {
+    return false;
   }
-  return false;
+  struct tm tm = {};
+  std::string date(ims);
+  const char *end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return end && *end == '\0' && mtime <= timegm(&tm);
 }
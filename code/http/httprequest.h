@@ -2,19 +2,29 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
-#include "../pool/sqlconnpool.h"
+#include "../auth/authbackend.h"
+#include "credcache.h"
+#include "delimscan.h"
 #include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
-#include <mysql/mysql.h>
-#include <regex>
+#include <ctime>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
+// 增量式HTTP/1.1解析器，直接在连接的读缓冲区上扫描，不做逐行拷贝。
+// 新到的字节先由delimscan一次性生成'\n'、':'、' '的位图，逐行解析只查位图。
+// 未完成时记录相对buff.Peek()的偏移，下次read后从断点继续；
+// 解析完成后method/version/header返回指向缓冲区的string_view，
+// 在调用方Retrieve(RequestBytes())之前有效
 class HttpRequest {
 public:
   enum PARSE_STATE {
@@ -24,34 +34,93 @@ public:
     FINISH,
   };
 
+  enum PARSE_RESULT {
+    INCOMPLETE,
+    COMPLETE,
+    BAD_REQUEST,
+  };
+
+  enum VERIFY_RESULT {
+    VERIFY_FAIL,
+    VERIFY_OK,
+    VERIFY_BUSY, // 数据库连接不够，没有执行校验
+  };
+
   HttpRequest() { Init(); }
   ~HttpRequest() = default;
 
   void Init();
-  bool parse(Buffer &buff);
+  PARSE_RESULT parse(const Buffer &buff);
+  size_t RequestBytes() const { return state_ == FINISH ? pos_ : 0; }
+  PARSE_STATE State() const { return state_; }
+
   std::string path() const;
   std::string &path();
-  std::string method() const;
-  std::string version() const;
+  std::string_view method() const;
+  std::string_view version() const;
+  std::string_view GetHeader(std::string_view key) const;
   std::string GetPost(const std::string &key) const;
   std::string GetPost(const char *key) const;
   bool IsKeepAlive() const;
+  // 条件GET：If-None-Match优先，没有时看If-Modified-Since。
+  // etag为当前表示的校验值(带引号)，命中时应回304
+  bool NotModified(std::string_view etag, time_t mtime) const;
+  // 登录/注册要查数据库，解析时只做分类，由调用方放到数据库线程执行
+  bool NeedsDb() const { return dbTag_ >= 0; }
+  // 提交数据库校验，完成后按结果改写path并调用done(在SqlAsync的事件线程)；
+  // 等连接超时则path不变，done的参数为true。查询排队已满时返回false，不会调用done
+  bool HandleDb(std::function<void(bool busy)> done);
+  // 凭证缓存能直接判定，或用户存储在本进程内时，同步改写path并返回true
+  bool TryInlineDb();
+  // 数据库线程繁忙，不执行校验
+  void SkipDb() { dbTag_ = -1; }
+
+  // 用户表的存取后端，由WebServer设置
+  static AuthBackend *auth;
 
 private:
-  bool ParseRequestLine_(const std::string &line);
-  void ParseHeader_(const std::string &line);
-  void ParseBody_(const std::string &line);
+  struct Range {
+    uint32_t off;
+    uint32_t len;
+  };
+  struct Field {
+    Range key;
+    Range value;
+  };
+
+  bool ParseRequestLine_(const char *base, size_t begin, size_t end);
+  bool ParseHeader_(const char *base, size_t begin, size_t end);
+  bool ParseHeadersEnd_(const char *base);
+  void ParseBody_(const char *base);
   void ParsePath_();
   void ParsePost_();
   void ParseFromUrlencoded_();
 
+  std::string_view View_(Range r) const {
+    return std::string_view(base_ + r.off, r.len);
+  }
+
   static bool UserVerify(const std::string &name, const std::string &pwd,
-                         bool isLogin);
+                         bool isLogin,
+                         std::function<void(VERIFY_RESULT)> done);
+  static bool CachedVerify_(const std::string &name, const std::string &pwd,
+                            bool isLogin, bool *ok);
+
+  // 请求行+头部、请求体的上限，超过按400处理
+  static constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+  static constexpr size_t MAX_BODY_BYTES = 1024 * 1024;
 
   PARSE_STATE state_;
-  std::string method_, path_, version_, body_;
-  std::unordered_map<std::string, std::string> header_;
+  size_t pos_;
+  size_t bodyLen_;
+  size_t scanned_; // 已生成分隔符位图的字节数
+  std::vector<delimscan::Block> delims_;
+  const char *base_;
+  Range method_, version_;
+  std::vector<Field> header_;
+  std::string path_, body_;
   std::unordered_map<std::string, std::string> post_;
+  int dbTag_; // 待执行的数据库操作：1登录，0注册，-1无
 
   static const std::unordered_set<std::string> DEFAULT_HTML;
   static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
@@ -1,4 +1,18 @@
 #include "httpresponse.h"
+#include "httprequest.h"
+
+#include <random>
+#include <strings.h>
+
+bool HttpResponse::useSendfile = false;
+
+// multipart/byteranges的分隔符，进程启动时随机生成
+const std::string HttpResponse::BOUNDARY = [] {
+  char buf[32];
+  std::random_device rd;
+  snprintf(buf, sizeof(buf), "%08x%08x", rd(), rd());
+  return std::string(buf);
+}();
 
 const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE = {
     {".html", "text/html"},
@@ -18,72 +32,287 @@ const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE = {
     {".avi", "video/x-msvideo"},
     {".gz", "application/x-gzip"},
     {".tar", "application/x-tar"},
-    {".css", "text/css "},
-    {".js", "text/javascript "},
+    {".css", "text/css"},
+    {".js", "text/javascript"},
+    {".svg", "image/svg+xml"},
+    {".ico", "image/x-icon"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".ttf", "font/ttf"},
+    {".otf", "font/otf"},
 };
 
+// 默认页面每次校验，其余静态资源缓存一天；未登记的后缀按no-cache
+std::unordered_map<std::string, std::string> HttpResponse::cacheControl_ = [] {
+  std::unordered_map<std::string, std::string> policy;
+  for (const auto &kv : SUFFIX_TYPE) {
+    policy[kv.first] = "public, max-age=86400";
+  }
+  policy[".html"] = policy[".xhtml"] = "no-cache";
+  return policy;
+}();
+
 const std::unordered_map<int, std::string> HttpResponse::CODE_STATUS = {
     {200, "OK"},
+    {206, "Partial Content"},
+    {304, "Not Modified"},
     {400, "Bad Request"},
     {403, "Forbidden"},
     {404, "Not Found"},
+    {416, "Range Not Satisfiable"},
+    {503, "Service Unavailable"},
 };
 
 const std::unordered_map<int, std::string> HttpResponse::CODE_PATH = {
     {400, "/400.html"},
     {403, "/403.html"},
     {404, "/404.html"},
+    {503, "/503.html"},
 };
 
 HttpResponse::HttpResponse() {
   code_ = -1;
   path_ = srcDir_ = "";
   isKeepAlive_ = false;
-  mmFile_ = nullptr;
-  mmFileStat_ = {0};
+  encoding_ = codec::IDENTITY;
+  vary_ = false;
 };
 
-HttpResponse::~HttpResponse() { UnmapFile(); }
+HttpResponse::~HttpResponse() = default;
 
 void HttpResponse::Init(const std::string &srcDir, std::string &path,
                         bool isKeepAlive, int code) {
   assert(srcDir != "");
-  if (mmFile_) {
-    UnmapFile();
-  }
+  ReleaseFile();
   code_ = code;
   isKeepAlive_ = isKeepAlive;
+  encoding_ = codec::IDENTITY;
+  vary_ = false;
+  ranges_.clear();
   path_ = path;
   srcDir_ = srcDir;
-  mmFile_ = nullptr;
-  mmFileStat_ = {0};
 }
 
-void HttpResponse::MakeResponse(Buffer &buff) {
-  if (stat((srcDir_ + path_).data(), &mmFileStat_) < 0 ||
-      S_ISDIR(mmFileStat_.st_mode))
-    code_ = 404;
+void HttpResponse::MakeResponse(Buffer &buff, const HttpRequest *request) {
+  // 解析失败(400)或数据库繁忙(503)的请求保留状态码，不再按路径查找文件
+  if (code_ < 400) {
+    file_ = FileCache::Instance()->Get(srcDir_ + path_);
+    if (!file_->exists || S_ISDIR(file_->st.st_mode))
+      code_ = 404;
 
-  else if (!(mmFileStat_.st_mode & S_IROTH))
-    code_ = 403;
+    else if (!(file_->st.st_mode & S_IROTH))
+      code_ = 403;
 
-  else if (code_ == -1)
-    code_ = 200;
+    else if (code_ == -1)
+      code_ = 200;
+  }
 
   ErrorHtml_();
+  if (code_ == 200 && file_->readable && S_ISREG(file_->st.st_mode)) {
+    if (codec::Compressible(file_->mime)) {
+      vary_ = true;
+      if (request) {
+        codec::Encoding enc =
+            codec::Negotiate(request->GetHeader("Accept-Encoding"));
+        if (enc != codec::IDENTITY) {
+          blob_ = file_->Variant(enc);
+          encoding_ = blob_ ? enc : codec::IDENTITY;
+        }
+      }
+    }
+    // 校验值对应协商出的表示，304不带正文
+    if (request && request->NotModified(ETag_(), file_->st.st_mtime)) {
+      code_ = 304;
+      blob_.reset();
+    } else if (request) {
+      std::string_view range = request->GetHeader("Range");
+      if (!range.empty()) {
+        ApplyRange_(range, request->GetHeader("If-Range"));
+      }
+      if (code_ != 200) {
+        // 分段按未压缩的内容计算
+        blob_.reset();
+        encoding_ = codec::IDENTITY;
+      }
+    }
+  }
+  if ((code_ == 200 || CODE_PATH.count(code_)) && file_ &&
+      BlobCache::Instance()->Cacheable(*file_)) {
+    BlobCache::BlobPtr full =
+        BlobCache::Instance()->Get(file_, code_, isKeepAlive_, encoding_);
+    if (!full) {
+      full = MakeBlob_();
+    }
+    if (full) {
+      blob_ = full;
+      file_.reset();
+      return;
+    }
+  }
   AddStateLine_(buff);
   AddHeader_(buff);
   AddContent_(buff);
 }
 
-char *HttpResponse::File() { return mmFile_; }
+// 解析Range，成功时改为206并记下各段，全部不可满足时改为416；
+// 格式不对、段数过多或If-Range不匹配时忽略Range，照常返回整个文件
+void HttpResponse::ApplyRange_(std::string_view range,
+                               std::string_view ifRange) {
+  if (!ifRange.empty() && ifRange != file_->etag &&
+      ifRange != file_->lastModified) {
+    return;
+  }
+  if (range.size() < 6 || strncasecmp(range.data(), "bytes=", 6) != 0) {
+    return;
+  }
+  range.remove_prefix(6);
+  off_t size = file_->st.st_size;
+  std::vector<std::pair<off_t, off_t>> ranges;
+  size_t count = 0;
+  while (!range.empty()) {
+    size_t comma = range.find(',');
+    std::string_view spec = range.substr(0, comma);
+    range = comma == std::string_view::npos ? "" : range.substr(comma + 1);
+    while (!spec.empty() && (spec.front() == ' ' || spec.front() == '\t')) {
+      spec.remove_prefix(1);
+    }
+    while (!spec.empty() && (spec.back() == ' ' || spec.back() == '\t')) {
+      spec.remove_suffix(1);
+    }
+    if (spec.empty()) {
+      continue;
+    }
+    if (++count > MAX_RANGES) {
+      return;
+    }
+    size_t dash = spec.find('-');
+    if (dash == std::string_view::npos) {
+      return;
+    }
+    std::string_view a = spec.substr(0, dash), b = spec.substr(dash + 1);
+    off_t first = 0, last = 0;
+    bool hasFirst = !a.empty(), hasLast = !b.empty();
+    for (char ch : a) {
+      if (!isdigit(static_cast<unsigned char>(ch)) || first > size) {
+        return;
+      }
+      first = first * 10 + (ch - '0');
+    }
+    for (char ch : b) {
+      if (!isdigit(static_cast<unsigned char>(ch))) {
+        return;
+      }
+      // 超过文件大小的部分按文件末尾截断，不必继续累加
+      if (last <= size) {
+        last = last * 10 + (ch - '0');
+      }
+    }
+    if (!hasFirst && !hasLast) {
+      return;
+    }
+    if (!hasFirst) {
+      // 后缀形式"-n"：最后n个字节
+      if (last == 0) {
+        continue;
+      }
+      first = last >= size ? 0 : size - last;
+      last = size - 1;
+    } else {
+      if (hasLast && last < first) {
+        return;
+      }
+      if (!hasLast || last >= size) {
+        last = size - 1;
+      }
+    }
+    if (first < size) {
+      ranges.emplace_back(first, last);
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+  if (ranges.empty()) {
+    code_ = 416;
+    return;
+  }
+  ranges_ = std::move(ranges);
+  code_ = 206;
+}
+
+void HttpResponse::AddRanges_(Buffer &buff) {
+  std::string total = "/" + std::to_string(file_->st.st_size);
+  if (ranges_.size() == 1) {
+    off_t first = ranges_[0].first, last = ranges_[0].second;
+    buff.Append("Content-Range: bytes " + std::to_string(first) + "-" +
+                std::to_string(last) + total + "\r\n");
+    buff.Append("Content-length: " + std::to_string(last - first + 1) +
+                "\r\n\r\n");
+    parts_.push_back({buff.ReadableBytes(), first,
+                      static_cast<size_t>(last - first + 1)});
+    return;
+  }
+  // multipart/byteranges：每段前加分隔和分段头，最后是结束分隔
+  std::vector<std::string> heads;
+  size_t len = 0;
+  for (const auto &r : ranges_) {
+    heads.push_back("\r\n--" + BOUNDARY + "\r\nContent-Type: " +
+                    file_->mime + "\r\nContent-Range: bytes " +
+                    std::to_string(r.first) + "-" + std::to_string(r.second) +
+                    total + "\r\n\r\n");
+    len += heads.back().size() + (r.second - r.first + 1);
+  }
+  std::string tail = "\r\n--" + BOUNDARY + "--\r\n";
+  len += tail.size();
+  buff.Append("Content-length: " + std::to_string(len) + "\r\n\r\n");
+  for (size_t i = 0; i < ranges_.size(); ++i) {
+    buff.Append(heads[i]);
+    parts_.push_back({buff.ReadableBytes(), ranges_[i].first,
+                      static_cast<size_t>(ranges_[i].second -
+                                          ranges_[i].first + 1)});
+  }
+  buff.Append(tail);
+}
+
+// 生成完整响应放进缓存，读文件失败返回空，退回普通路径
+BlobCache::BlobPtr HttpResponse::MakeBlob_() {
+  Buffer head;
+  AddStateLine_(head);
+  AddHeader_(head);
+  AddContent_(head);
+  std::string blob = head.RetrieveAllToStr();
+  if (blob_) {
+    // 压缩后的正文
+    blob += *blob_;
+    return BlobCache::Instance()->Put(file_, code_, isKeepAlive_, encoding_,
+                                      std::move(blob));
+  }
+  size_t off = blob.size();
+  size_t size = file_->st.st_size;
+  blob.resize(off + size);
+  if (file_->data) {
+    memcpy(&blob[off], file_->data, size);
+  } else if (file_->fd >= 0) {
+    for (size_t n = 0; n < size;) {
+      ssize_t len = pread(file_->fd, &blob[off + n], size - n, n);
+      if (len <= 0) {
+        return nullptr;
+      }
+      n += len;
+    }
+  }
+  return BlobCache::Instance()->Put(file_, code_, isKeepAlive_, encoding_,
+                                    std::move(blob));
+}
 
-size_t HttpResponse::FileLen() const { return mmFileStat_.st_size; }
+size_t HttpResponse::FileLen() const {
+  return file_ && file_->readable ? file_->st.st_size : 0;
+}
 
 void HttpResponse::ErrorHtml_() {
   if (CODE_PATH.count(code_) == 1) {
     path_ = CODE_PATH.find(code_)->second;
-    stat((srcDir_ + path_).data(), &mmFileStat_);
+    file_ = FileCache::Instance()->Get(srcDir_ + path_);
   }
 }
 
@@ -106,41 +335,98 @@ void HttpResponse::AddHeader_(Buffer &buff) {
   } else {
     buff.Append("close\r\n");
   }
-  buff.Append("Content-type: " + GetFileType_() + "\r\n");
+  if (code_ == 200 || code_ == 206 || code_ == 304) {
+    if (file_ && S_ISREG(file_->st.st_mode)) {
+      buff.Append("ETag: " + ETag_() + "\r\n");
+      buff.Append("Last-Modified: " + file_->lastModified + "\r\n");
+      if (!file_->cacheControl.empty()) {
+        buff.Append("Cache-Control: " + file_->cacheControl + "\r\n");
+      }
+    }
+  }
+  if (code_ == 304) {
+    if (vary_) {
+      buff.Append("Vary: Accept-Encoding\r\n");
+    }
+    return;
+  }
+  if (ranges_.size() > 1) {
+    buff.Append("Content-type: multipart/byteranges; boundary=" + BOUNDARY +
+                "\r\n");
+  } else {
+    buff.Append("Content-type: " + (file_ ? file_->mime : FileType(path_)) +
+                "\r\n");
+  }
+  if ((code_ == 200 || code_ == 206) && S_ISREG(file_->st.st_mode)) {
+    buff.Append("Accept-Ranges: bytes\r\n");
+  }
+  if (vary_) {
+    buff.Append("Vary: Accept-Encoding\r\n");
+  }
+  if (encoding_ != codec::IDENTITY) {
+    buff.Append(std::string("Content-Encoding: ") + codec::Name(encoding_) +
+                "\r\n");
+  }
 }
 
 void HttpResponse::AddContent_(Buffer &buff) {
-  int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-  if (srcFd < 0) {
-    ErrorContent(buff, "File NotFound");
+  if (code_ == 304) {
+    buff.Append("\r\n");
+    file_.reset();
     return;
   }
-
-  LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-  int *mmRet =
-      (int *)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-  if (*mmRet == -1) {
+  if (code_ == 416) {
+    buff.Append("Content-Range: bytes */" +
+                std::to_string(file_->st.st_size) +
+                "\r\nContent-length: 0\r\n\r\n");
+    file_.reset();
+    return;
+  }
+  if (!file_ || !file_->readable) {
     ErrorContent(buff, "File NotFound");
     return;
   }
-  mmFile_ = (char *)mmRet;
-  close(srcFd);
-  buff.Append("Content-length: " + std::to_string(mmFileStat_.st_size) +
-              "\r\n");
+  if (code_ == 206) {
+    AddRanges_(buff);
+    return;
+  }
+  LOG_DEBUG("file path %s", (srcDir_ + path_).data());
+  size_t len = blob_ ? blob_->size() : file_->st.st_size;
+  buff.Append("Content-length: " + std::to_string(len) + "\r\n\r\n");
 }
 
-void HttpResponse::UnmapFile() {
-  if (mmFile_) {
-    munmap(mmFile_, mmFileStat_.st_size);
-    mmFile_ = nullptr;
+// 压缩表示的校验值在文件校验值后加编码名，与原文区分
+std::string HttpResponse::ETag_() const {
+  if (encoding_ == codec::IDENTITY) {
+    return file_->etag;
   }
+  std::string etag = file_->etag;
+  etag.insert(etag.size() - 1, std::string("-") + codec::Name(encoding_));
+  return etag;
 }
-std::string HttpResponse::GetFileType_() {
-  std::string::size_type idx = path_.find_last_of('.');
+
+void HttpResponse::SetCacheControl(const std::string &suffix,
+                                   const std::string &policy) {
+  cacheControl_[suffix] = policy;
+}
+
+std::string HttpResponse::CacheControl(const std::string &path) {
+  std::string::size_type idx = path.find_last_of('.');
+  if (idx != std::string::npos) {
+    auto it = cacheControl_.find(path.substr(idx));
+    if (it != cacheControl_.end()) {
+      return it->second;
+    }
+  }
+  return "no-cache";
+}
+
+std::string HttpResponse::FileType(const std::string &path) {
+  std::string::size_type idx = path.find_last_of('.');
   if (idx == std::string::npos) {
     return "text/plain";
   }
-  std::string suffix = path_.substr(idx);
+  std::string suffix = path.substr(idx);
   if (SUFFIX_TYPE.count(suffix) == 1) {
     return SUFFIX_TYPE.find(suffix)->second;
   }
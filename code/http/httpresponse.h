@@ -1,44 +1,91 @@
 #pragma once
 
-#include <fcntl.h>
+#include <memory>
 #include <string>
-#include <sys/mman.h>
+#include <string_view>
 #include <sys/stat.h>
-#include <unistd.h>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "blobcache.h"
+#include "codec.h"
+#include "filecache.h"
+
+class HttpRequest;
 
 class HttpResponse {
 public:
+  // 206的一段正文：headEnd为这段之前的头部(含分段头)写完后buff中的字节数，
+  // 正文为文件的[off, off + len)
+  struct Part {
+    size_t headEnd;
+    off_t off;
+    size_t len;
+  };
+
   HttpResponse();
   ~HttpResponse();
 
   void Init(const std::string &srcDir, std::string &path,
             bool isKeepAlive = false, int code = -1);
-  void MakeResponse(Buffer &buff);
-  void UnmapFile();
-  char *File();
+  // request用于协商编码等，解析失败的请求传空
+  void MakeResponse(Buffer &buff, const HttpRequest *request = nullptr);
+  // 正文所在的缓存条目，调用方持有引用直到发送完成
+  const std::shared_ptr<const CachedFile> &File() const { return file_; }
   size_t FileLen() const;
+  // 内存中的待发送数据：命中小文件响应缓存时是整个响应(不写buff也不带File)，
+  // 否则是压缩后的正文，头部在buff中
+  const BlobCache::BlobPtr &Blob() const { return blob_; }
+  // 非空时是Range请求的各段正文，buff中多出的尾部是multipart结束分隔
+  const std::vector<Part> &Parts() const { return parts_; }
+  void ReleaseFile() {
+    file_.reset();
+    blob_.reset();
+    parts_.clear();
+  }
   void ErrorContent(Buffer &buff, std::string message);
   int Code() const { return code_; }
 
+  static std::string FileType(const std::string &path);
+  // 按后缀配置Cache-Control，policy为空时不发送；需在启动前设置，
+  // 文件加载进缓存时取值
+  static void SetCacheControl(const std::string &suffix,
+                              const std::string &policy);
+  static std::string CacheControl(const std::string &path);
+
+  // true: 正文不映射，只打开fd交给调用方sendfile
+  static bool useSendfile;
+
 private:
   void AddStateLine_(Buffer &buff);
   void AddHeader_(Buffer &buff);
   void AddContent_(Buffer &buff);
 
   void ErrorHtml_();
-  std::string GetFileType_();
+  BlobCache::BlobPtr MakeBlob_();
+  void ApplyRange_(std::string_view range, std::string_view ifRange);
+  void AddRanges_(Buffer &buff);
+  std::string ETag_() const;
 
   int code_;
   bool isKeepAlive_;
   std::string path_;
   std::string srcDir_;
-  char *mmFile_;
-  struct stat mmFileStat_;
+  std::shared_ptr<const CachedFile> file_;
+  BlobCache::BlobPtr blob_;
+  codec::Encoding encoding_;
+  bool vary_; // 响应随Accept-Encoding变化
+  std::vector<std::pair<off_t, off_t>> ranges_; // 206的各段[first, last]
+  std::vector<Part> parts_;
+
+  // 超过这个段数的Range请求按整个文件返回
+  static const size_t MAX_RANGES = 16;
+  static const std::string BOUNDARY;
   static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
+  static std::unordered_map<std::string, std::string> cacheControl_;
   static const std::unordered_map<int, std::string> CODE_STATUS;
   static const std::unordered_map<int, std::string> CODE_PATH;
 };
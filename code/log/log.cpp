@@ -1,31 +1,59 @@
 #include "log.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 Log::Log() {
   fp_ = nullptr;
-  deque_ = nullptr;
   writeThread_ = nullptr;
   lineCount_ = 0;
+  fileSeq_ = 0;
   toDay_ = 0;
+  isOpen_ = false;
+  level_ = 1;
   isAsync_ = false;
+  mode_ = TEXT;
+  deferred_ = false;
+  ringSize_ = 0;
+  fileBuf_.reset(new char[FILE_BUF_SIZE]);
+  wake_ = false;
+  stop_ = false;
+  synced_ = 0;
+  useTsc_ = false;
+  tsc0_ = ns0_ = 0;
 }
 
 Log::~Log() {
-  while (!deque_->empty()) {
-    deque_->Flush();
+  if (writeThread_ && writeThread_->joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(wakeMtx_);
+      stop_ = true;
+    }
+    wakeCond_.notify_one();
+    writeThread_->join();
   }
-  deque_->Close();
-  writeThread_->join();
   if (fp_) {
     std::lock_guard<std::mutex> lock(mtx_);
-    flush();
+    fflush(fp_);
     fclose(fp_);
   }
 }
 
+// 异步模式下只唤醒写线程，不等待写完
 void Log::flush() {
-  if (isAsync_)
-    deque_->Flush();
-  fflush(fp_);
+  if (isAsync_) {
+    // 持锁通知，避免写线程检查完条件、尚未休眠时错过唤醒
+    if (!wake_.exchange(true)) {
+      std::lock_guard<std::mutex> lock(wakeMtx_);
+      wakeCond_.notify_one();
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (fp_) {
+    fflush(fp_);
+  }
 }
 
 // 懒汉模式，局部静态变量法
@@ -36,145 +64,366 @@ Log *Log::Instance() {
 
 void Log::FlushLogThread() { Log::Instance()->AsyncWrite_(); }
 
+// 每隔FLUSH_INTERVAL或被提前唤醒时取空所有缓冲区，整批写完再fflush
 void Log::AsyncWrite_() {
-  std::string str = "";
-  while (deque_->pop(str)) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    fputs(str.c_str(), fp_);
+  bool stop = false;
+  while (!stop) {
+    {
+      std::unique_lock<std::mutex> lock(wakeMtx_);
+      wakeCond_.wait_for(lock, FLUSH_INTERVAL,
+                         [this] { return wake_.load() || stop_; });
+      stop = stop_;
+    }
+    wake_ = false;
+    size_t dropped;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      time_t timer = time(nullptr);
+      struct tm sysTime;
+      localtime_r(&timer, &sysTime);
+      Rotate_(sysTime);
+      dropped = Drain_();
+      fflush(fp_);
+    }
+    if (dropped) {
+      LOG_WARN("Log buffer full, %zu lines dropped", dropped);
+    }
   }
 }
 
-void Log::init(int level, const char *path, const char *suffix,
-               int maxQueCapacity) {
-  isOpen_ = true;
-  level_ = level;
-  path_ = path;
-  suffix_ = suffix;
-  if (maxQueCapacity) {
-    isAsync_ = true;
-    if (!deque_) {
-      std::unique_ptr<BlockQueue<std::string>> newQue(
-          new BlockQueue<std::string>);
-      deque_ = std::move(newQue);
-      std::unique_ptr<std::thread> newThread(new std::thread(FlushLogThread));
-      writeThread_ = std::move(newThread);
+Log::LocalRing *Log::Ring_() {
+  // 线程退出时标记缓冲区关闭，由写线程回收
+  struct Holder {
+    std::shared_ptr<LocalRing> local;
+    ~Holder() {
+      if (local) {
+        local->closed.store(true, std::memory_order_release);
+      }
+    }
+  };
+  // 带析构的thread_local每次访问都要检查初始化，常用路径只读裸指针
+  thread_local LocalRing *cached = nullptr;
+  if (cached) {
+    return cached;
+  }
+  thread_local Holder holder;
+  holder.local.reset(new LocalRing(ringSize_));
+  {
+    std::lock_guard<std::mutex> lock(ringMtx_);
+    rings_.push_back(holder.local);
+  }
+  cached = holder.local.get();
+  return cached;
+}
+
+// 调用方持有mtx_；返回这一轮各线程丢弃的行数
+size_t Log::Drain_() {
+  std::vector<std::shared_ptr<LocalRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock(ringMtx_);
+    rings = rings_;
+  }
+  size_t dropped = 0;
+  bool reap = false;
+  for (const std::shared_ptr<LocalRing> &local : rings) {
+    // 先看closed再取：取完之后已退出的线程不会再写入
+    bool closed = local->closed.load(std::memory_order_acquire);
+    local->ring.Drain([this](const char *data, size_t len) {
+      if (mode_ != TEXT) {
+        records_.append(data, len);
+        return;
+      }
+      fwrite(data, 1, len, fp_);
+      const char *end = data + len;
+      while ((data = static_cast<const char *>(
+                  memchr(data, '\n', end - data)))) {
+        ++lineCount_;
+        ++data;
+      }
+    });
+    dropped += local->dropped.exchange(0, std::memory_order_relaxed);
+    reap = reap || closed;
+  }
+  if (mode_ != TEXT) {
+    WriteRecords_();
+  }
+  if (reap) {
+    std::lock_guard<std::mutex> lock(ringMtx_);
+    for (size_t i = 0; i < rings_.size();) {
+      if (rings_[i]->closed.load(std::memory_order_acquire) &&
+          rings_[i]->ring.Size() == 0) {
+        rings_[i] = std::move(rings_.back());
+        rings_.pop_back();
+      } else {
+        ++i;
+      }
+    }
+  }
+  return dropped;
+}
+
+// 调用方持有mtx_。取出的记录所引用的调用点都已登记，先同步调用点再处理记录；
+// 记录里的TSC按从init到现在的平均频率，以现在为基准换算成时间
+void Log::WriteRecords_() {
+  SyncSites_();
+  uint64_t tsc = Now_();
+  uint64_t ns = WallNs_();
+  double rate = 1;
+  if (useTsc_ && tsc > tsc0_) {
+    rate = static_cast<double>(ns - ns0_) / static_cast<double>(tsc - tsc0_);
+  }
+  size_t off = 0;
+  while (size_t size = LogCodec::RecordSize(records_.data() + off,
+                                            records_.size() - off)) {
+    char *record = &records_[off];
+    if (useTsc_) {
+      int64_t ticks = static_cast<int64_t>(tsc - LogCodec::Time(record));
+      LogCodec::SetTime(record, ns - static_cast<int64_t>(ticks * rate));
+    }
+    if (mode_ == BINARY || codec_.Decode(record, size, &text_)) {
+      ++lineCount_;
     }
+    off += size;
+  }
+  if (mode_ == BINARY) {
+    fwrite(records_.data(), 1, records_.size(), fp_);
   } else {
-    isAsync_ = false;
+    fwrite(text_.data(), 1, text_.size(), fp_);
   }
+  records_.clear();
+  text_.clear();
+}
 
-  lineCount_ = 0;
-  time_t timer = time(nullptr);
-  struct tm *sysTime = localtime(&timer);
+// 调用方持有mtx_
+void Log::SyncSites_() {
+  std::lock_guard<std::mutex> lock(siteMtx_);
+  for (; synced_ < sites_.size(); ++synced_) {
+    if (mode_ == DEFERRED) {
+      codec_.Define(sites_[synced_]);
+    } else {
+      char record[LogCodec::MAX_RECORD];
+      size_t len =
+          LogCodec::EncodeDefine(record, sizeof(record), sites_[synced_]);
+      fwrite(record, 1, len, fp_);
+    }
+  }
+}
+
+const LogCodec::Site *Log::Define(int level, const char *format,
+                                  const char *file, int line) {
+  LogCodec::Site site;
+  site.level = level;
+  site.file = file;
+  site.line = line;
+  site.format = format;
+  LogCodec::Parse(&site);
+  std::lock_guard<std::mutex> lock(siteMtx_);
+  site.id = static_cast<uint32_t>(sites_.size());
+  sites_.push_back(std::move(site));
+  return &sites_.back();
+}
+
+uint64_t Log::Now_() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (useTsc_) {
+    return __rdtsc();
+  }
+#endif
+  return WallNs_();
+}
+
+uint64_t Log::WallNs_() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// 内核选tsc作时钟源说明TSC频率恒定且各核同步
+bool Log::TscUsable_() {
+#if defined(__x86_64__) || defined(__i386__)
+  FILE *fp = fopen(
+      "/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+  if (!fp) {
+    return false;
+  }
+  char name[32] = {0};
+  bool tsc = fgets(name, sizeof(name), fp) && strncmp(name, "tsc", 3) == 0;
+  fclose(fp);
+  return tsc;
+#else
+  return false;
+#endif
+}
+
+void Log::init(int level, const char *path, const char *suffix,
+               int maxQueCapacity, int mode) {
+  level_ = level;
   path_ = path;
   suffix_ = suffix;
+  lineCount_ = 0;
+  fileSeq_ = 0;
+  time_t timer = time(nullptr);
+  struct tm sysTime;
+  localtime_r(&timer, &sysTime);
   char fileName[LOG_NAME_LEN] = {0};
   snprintf(fileName, LOG_NAME_LEN - 1, "%s%04d_%02d_%02d%s", path_,
-           sysTime->tm_year + 1900, sysTime->tm_mon + 1, sysTime->tm_mday,
+           sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday,
            suffix_);
-  toDay_ = sysTime->tm_mday;
-
+  toDay_ = sysTime.tm_mday;
+  mode_ = maxQueCapacity > 0 ? mode : TEXT;
+  deferred_ = mode_ != TEXT;
+  useTsc_ = deferred_ && TscUsable_();
+  ns0_ = WallNs_();
+  tsc0_ = Now_();
   {
     std::lock_guard<std::mutex> lock(mtx_);
-    buff_.RetrieveAll();
-    if (fp_) {
-      flush();
-      fclose(fp_);
+    Open_(fileName);
+  }
+
+  if (maxQueCapacity > 0) {
+    isAsync_ = true;
+    // 缓冲区取不小于估算大小的2的幂，至少放得下几行最长的日志
+    size_t size = std::max(static_cast<size_t>(maxQueCapacity) * LINE_BYTES,
+                           static_cast<size_t>(LINE_SIZE) * 4);
+    ringSize_ = 1;
+    while (ringSize_ < size) {
+      ringSize_ <<= 1;
     }
-    fp_ = fopen(fileName, "a"); // 附加写
-    if (fp_ == nullptr) {
-      mkdir(path_, 0777);
-      fp_ = fopen(fileName, "a"); // 附加写
+    if (!writeThread_) {
+      writeThread_.reset(new std::thread(FlushLogThread));
     }
-    assert(fp_);
+  } else {
+    isAsync_ = false;
   }
+  isOpen_ = true;
 }
 
-void Log::write(int level, const char *format, ...) {
-  struct timeval now = {0, 0};
-  gettimeofday(&now, nullptr);
-  time_t tSec = now.tv_sec;
-  struct tm *sysTime = localtime(&tSec);
-
-  va_list vaList;
-
-  if (toDay_ != sysTime->tm_mday ||
-      (lineCount_ && (lineCount_ % MAX_LINES == 0))) {
-    std::unique_lock<std::mutex> lock(mtx_);
-    lock.unlock();
-    char newFile[LOG_NAME_LEN] = {0};
-    char tail[36] = {0};
-    snprintf(tail, 36, "%04d_%02d_%02d", sysTime->tm_year + 1900,
-             sysTime->tm_mon + 1, sysTime->tm_mday);
-    if (toDay_ != sysTime->tm_mday) {
-      snprintf(newFile, LOG_NAME_LEN - 72, "%s%s%s", path_, tail, suffix_);
-      toDay_ = sysTime->tm_mday;
-      lineCount_ = 0;
-    } else {
-      snprintf(newFile, LOG_NAME_LEN - 72, "%s%s-%d%s", path_, tail,
-               (lineCount_ / MAX_LINES), suffix_);
-    }
-
-    lock.lock();
-    flush();
+// 调用方持有mtx_
+void Log::Open_(const char *fileName) {
+  if (fp_) {
+    fflush(fp_);
     fclose(fp_);
-    fp_ = fopen(newFile, "a");
-    assert(fp_);
   }
+  fp_ = fopen(fileName, "a"); // 附加写
+  if (fp_ == nullptr) {
+    mkdir(path_, 0777);
+    fp_ = fopen(fileName, "a"); // 附加写
+  }
+  assert(fp_);
+  setvbuf(fp_, fileBuf_.get(), _IOFBF, FILE_BUF_SIZE);
+  if (mode_ == BINARY) {
+    // 每个文件(包括追加的一段)都带上全部调用点，可以单独解码
+    fwrite(LogCodec::MAGIC, 1, sizeof(LogCodec::MAGIC), fp_);
+    synced_ = 0;
+    SyncSites_();
+  }
+}
 
-  // 在buffer生成一条日志
-  {
-    std::unique_lock<std::mutex> lock(mtx_);
-    ++lineCount_;
-    int n = snprintf(
-        buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-        sysTime->tm_year + 1900, sysTime->tm_mon + 1, sysTime->tm_mday,
-        sysTime->tm_hour, sysTime->tm_min, sysTime->tm_sec, now.tv_usec);
-    buff_.HasWritten(n);
-    AppendLogLevelTitle_(level);
-    va_start(vaList, format);
-    int m =
-        vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-    va_end(vaList);
+// 调用方持有mtx_；跨天或当前文件写满时换文件
+void Log::Rotate_(const struct tm &sysTime) {
+  if (toDay_ == sysTime.tm_mday && lineCount_ < MAX_LINES) {
+    return;
+  }
+  char newFile[LOG_NAME_LEN] = {0};
+  char tail[36] = {0};
+  snprintf(tail, 36, "%04d_%02d_%02d", sysTime.tm_year + 1900,
+           sysTime.tm_mon + 1, sysTime.tm_mday);
+  if (toDay_ != sysTime.tm_mday) {
+    snprintf(newFile, LOG_NAME_LEN - 72, "%s%s%s", path_, tail, suffix_);
+    toDay_ = sysTime.tm_mday;
+    fileSeq_ = 0;
+  } else {
+    snprintf(newFile, LOG_NAME_LEN - 72, "%s%s-%d%s", path_, tail, ++fileSeq_,
+             suffix_);
+  }
+  lineCount_ = 0;
+  Open_(newFile);
+}
 
-    buff_.HasWritten(m);
-    buff_.Append("\n\0", 2);
+void Log::write(int level, const char *format, ...) {
+  char line[LINE_SIZE];
+  va_list vaList;
+  va_start(vaList, format);
+  if (deferred_) {
+    // 直接调用write没有调用点，格式化后作为一个字符串参数记录
+    static const LogCodec::Site *sites[] = {
+        Define(0, "%s", __FILE__, __LINE__),
+        Define(1, "%s", __FILE__, __LINE__),
+        Define(2, "%s", __FILE__, __LINE__),
+        Define(3, "%s", __FILE__, __LINE__)};
+    vsnprintf(line, LINE_SIZE, format, vaList);
+    va_end(vaList);
+    Record(sites[level >= 0 && level <= 3 ? level : 1], line);
+    return;
+  }
+  size_t len = Format_(level, format, vaList, line);
+  va_end(vaList);
 
-    if (isAsync_ && deque_ && !deque_->full()) {
-      deque_->push_back(buff_.RetrieveAllToStr());
-    } else {
-      fputs(buff_.Peek(), fp_);
-    }
-    buff_.RetrieveAll();
+  if (isAsync_) {
+    Push_(level, line, len);
+    return;
   }
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  time_t timer = time(nullptr);
+  struct tm sysTime;
+  localtime_r(&timer, &sysTime);
+  Rotate_(sysTime);
+  fwrite(line, 1, len, fp_);
+  ++lineCount_;
+  fflush(fp_);
 }
 
-void Log::AppendLogLevelTitle_(int level) {
-  switch (level) {
-  case 0:
-    buff_.Append("[debug]: ", 9);
-    break;
-  case 1:
-    buff_.Append("[info] : ", 9);
-    break;
-  case 2:
-    buff_.Append("[warn] : ", 9);
-    break;
-  case 3:
-    buff_.Append("[error]: ", 9);
-    break;
-  default:
-    buff_.Append("[info] : ", 9);
-    break;
+void Log::Push_(int level, const char *data, size_t len) {
+  LocalRing *local = Ring_();
+  if (!local->ring.TryWrite(data, len)) {
+    local->dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+  // 警告以上的日志或缓冲区过半时提前唤醒写线程，每轮只通知一次
+  if ((level >= 2 || local->ring.OverHalf()) &&
+      !wake_.load(std::memory_order_relaxed)) {
+    flush();
   }
 }
 
-int Log::GetLevel() {
-  std::lock_guard<std::mutex> lock(mtx_);
-  return level_;
-}
+// 在line生成一条以换行结尾的日志，返回长度。
+// 时间前缀按秒缓存在线程里，同一秒内不再调用localtime
+size_t Log::Format_(int level, const char *format, va_list vaList,
+                    char *line) {
+  thread_local time_t lastSec = -1;
+  thread_local char secPrefix[32];
+  thread_local size_t secLen = 0;
+  struct timeval now = {0, 0};
+  gettimeofday(&now, nullptr);
+  if (now.tv_sec != lastSec) {
+    struct tm sysTime;
+    localtime_r(&now.tv_sec, &sysTime);
+    secLen = snprintf(secPrefix, sizeof(secPrefix),
+                      "%d-%02d-%02d %02d:%02d:%02d", sysTime.tm_year + 1900,
+                      sysTime.tm_mon + 1, sysTime.tm_mday, sysTime.tm_hour,
+                      sysTime.tm_min, sysTime.tm_sec);
+    lastSec = now.tv_sec;
+  }
+  memcpy(line, secPrefix, secLen);
+  size_t n = secLen;
+  line[n++] = '.';
+  long usec = now.tv_usec;
+  for (int i = 5; i >= 0; --i) {
+    line[n + i] = static_cast<char>('0' + usec % 10);
+    usec /= 10;
+  }
+  n += 6;
+  line[n++] = ' ';
 
-void Log::SetLevel(int level) {
-  std::lock_guard<std::mutex> lock(mtx_);
-  level_ = level;
+  const char *title = LogCodec::Title(level);
+  memcpy(line + n, title, 9);
+  n += 9;
+
+  // 留一个字节给换行
+  int m = vsnprintf(line + n, LINE_SIZE - n - 1, format, vaList);
+  if (m > 0) {
+    n += std::min(static_cast<size_t>(m), LINE_SIZE - n - 2);
+  }
+  line[n++] = '\n';
+  return n;
 }
@@ -1,77 +1,148 @@
 #pragma once
 
-#include "../buffer/buffer.h"
-#include "blockqueue.h"
+#include "logcodec.h"
+#include "logring.h"
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <thread>
 #include <utility>
+#include <vector>
 
+// 异步模式下每个线程把格式化好的行写进自己的LogRing，不加锁；
+// 写线程定时或在某个缓冲区过半时把所有缓冲区批量写入文件，每轮只fflush一次。
+// 缓冲区满时丢弃该行并计数，由写线程记录丢弃的行数，调用方从不阻塞。
+// 不同线程的行按批交错写入，同一线程内保持顺序。
+// DEFERRED和BINARY模式下调用点不格式化，只记录调用点编号、时间和原始参数(LogCodec)，
+// DEFERRED由写线程格式化成文本，BINARY原样写入文件，用logdecoder还原
 class Log {
 public:
+  enum MODE { TEXT, DEFERRED, BINARY };
+
+  // maxQueueCapacity为每个线程缓冲区大约容纳的行数，0表示同步写(只支持TEXT)
   void init(int level, const char *path = "./log", const char *suffix = ".log",
-            int maxQueueCapacity = 1024);
+            int maxQueueCapacity = 1024, int mode = TEXT);
   static Log *Instance();
   static void FlushLogThread(); // 异步写日志，调用AsyncWrite_
 
   void write(int level, const char *format, ...);
   void flush();
 
-  int GetLevel();
-  void SetLevel(int level);
-  bool IsOpen() { return isOpen_; }
+  // 每个调用点登记一次，返回的指针在进程内一直有效
+  const LogCodec::Site *Define(int level, const char *format, const char *file,
+                               int line);
+  template <typename... Args>
+  void Record(const LogCodec::Site *site, const Args &...args) {
+    char record[LogCodec::MAX_RECORD];
+    size_t len = LogCodec::Encode(record, sizeof(record), *site, Now_(),
+                                  args...);
+    Push_(site->level, record, len);
+  }
+
+  int GetLevel() { return level_.load(std::memory_order_relaxed); }
+  void SetLevel(int level) { level_.store(level, std::memory_order_relaxed); }
+  bool IsOpen() { return isOpen_.load(std::memory_order_relaxed); }
+  bool IsDeferred() { return deferred_; }
 
 private:
+  // 线程退出后closed置位，写线程取完剩余内容后回收
+  struct LocalRing {
+    explicit LocalRing(size_t capacity) : ring(capacity) {}
+    LogRing ring;
+    std::atomic<size_t> dropped{0};
+    std::atomic<bool> closed{false};
+  };
+
   Log();
-  void AppendLogLevelTitle_(int level);
   virtual ~Log();
+  LocalRing *Ring_();
+  void Push_(int level, const char *data, size_t len);
+  uint64_t Now_();
+  static uint64_t WallNs_();
+  static bool TscUsable_();
+  size_t Format_(int level, const char *format, va_list vaList, char *line);
   void AsyncWrite_();
+  size_t Drain_();
+  void WriteRecords_();
+  void SyncSites_();
+  void Rotate_(const struct tm &sysTime);
+  void Open_(const char *fileName);
 
 private:
   static const int LOG_PATH_LEN = 256;
   static const int LOG_NAME_LEN = 256;
   static const int MAX_LINES = 50000; // 最大日志条数
+  static const int LINE_SIZE = 4096;  // 单行上限，超出截断
+  static const int LINE_BYTES = 128;  // 估算缓冲区大小用的平均行长
+  static const int FILE_BUF_SIZE = 1 << 18;
+  static constexpr std::chrono::milliseconds FLUSH_INTERVAL{100};
 
   const char *path_;
   const char *suffix_;
 
-  int lineCount_; // 日志行数记录
+  int lineCount_; // 当前文件的行数
+  int fileSeq_;   // 当天按行数切分的文件序号
   int toDay_;     // 按当天日期区分文件
 
-  bool isOpen_;
-
-  Buffer buff_;  // 日志输出的内容，缓冲区
-  int level_;    // 日志等级
-  bool isAsync_; // 是否开启异步日志
+  std::atomic<bool> isOpen_;
+  std::atomic<int> level_; // 日志等级
+  bool isAsync_;           // 是否开启异步日志
+  int mode_;               // MODE，同步写时总是TEXT
+  bool deferred_;          // 调用点只记录原始参数
+  size_t ringSize_;        // 每个线程缓冲区的字节数
 
   FILE *fp_; // 打开log的文件指针
-  std::unique_ptr<BlockQueue<std::string>> deque_;
+  std::unique_ptr<char[]> fileBuf_;
   std::unique_ptr<std::thread> writeThread_;
-  std::mutex mtx_;
+  std::mutex mtx_; // 保护文件，异步模式下只有写线程持有
+
+  std::mutex ringMtx_; // 保护rings_，线程首次写日志时登记
+  std::vector<std::shared_ptr<LocalRing>> rings_;
+  std::mutex wakeMtx_;
+  std::condition_variable wakeCond_;
+  std::atomic<bool> wake_; // 已请求写线程提前刷一轮
+  bool stop_;
+
+  std::mutex siteMtx_; // 保护sites_，调用点首次执行时登记
+  std::deque<LogCodec::Site> sites_;
+  size_t synced_;       // 已交给codec_或已写入当前二进制文件的调用点数
+  bool useTsc_;         // 调用点记TSC，写线程换算成时间
+  uint64_t tsc0_;       // 换算的起点
+  uint64_t ns0_;
+  LogCodec codec_;      // DEFERRED模式下写线程用来格式化
+  std::string records_; // 本轮取出的二进制记录
+  std::string text_;
 };
 
 #define LOG_BASE(level, format, ...) \
     do {\
         Log* log = Log::Instance();\
         if (log->IsOpen() && log->GetLevel() <= level) {\
-            log->write(level, format, ##__VA_ARGS__); \
-            log->flush();\
+            if (log->IsDeferred()) {\
+                static const LogCodec::Site *logSite =\
+                    log->Define(level, format, __FILE__, __LINE__);\
+                log->Record(logSite, ##__VA_ARGS__);\
+            } else {\
+                log->write(level, format, ##__VA_ARGS__); \
+            }\
         }\
     } while(0);
 
 // 四个宏定义，主要用于不同类型的日志输出，也是外部使用日志的接口
 // ...表示可变参数，__VA_ARGS__就是将...的值复制到这里
 // 前面加上##的作用是：当可变参数的个数为0时，这里的##可以把把前面多余的","去掉,否则会编译出错。
-#define LOG_DEBUG(format, ...) do {LOG_BASE(0, format, ##__VA_ARGS__)} while(0);    
+#define LOG_DEBUG(format, ...) do {LOG_BASE(0, format, ##__VA_ARGS__)} while(0);
 #define LOG_INFO(format, ...) do {LOG_BASE(1, format, ##__VA_ARGS__)} while(0);
 #define LOG_WARN(format, ...) do {LOG_BASE(2, format, ##__VA_ARGS__)} while(0);
 #define LOG_ERROR(format, ...) do {LOG_BASE(3, format, ##__VA_ARGS__)} while(0);
@@ -0,0 +1,402 @@
+#include "logcodec.h"
+
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+template <typename T>
+void Append(std::string *text, const std::string &fmt, T value) {
+  char buf[256];
+  int n = snprintf(buf, sizeof(buf), fmt.c_str(), value);
+  if (n < 0) {
+    return;
+  }
+  if (n < static_cast<int>(sizeof(buf))) {
+    text->append(buf, n);
+    return;
+  }
+  size_t old = text->size();
+  text->resize(old + n + 1);
+  snprintf(&(*text)[old], n + 1, fmt.c_str(), value);
+  text->resize(old + n);
+}
+
+void AppendInt(std::string *text, unsigned long long value, bool negative) {
+  char buf[24];
+  char *p = buf + sizeof(buf);
+  do {
+    *--p = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  if (negative) {
+    *--p = '-';
+  }
+  text->append(p, buf + sizeof(buf) - p);
+}
+
+} // namespace
+
+// p指向'%'之后，返回说明符之后的位置
+const char *LogCodec::ParseSpec_(const char *p, Spec *spec) {
+  while (*p && strchr("-+ #0'", *p)) {
+    spec->flags += *p++;
+  }
+  if (*p == '*') {
+    spec->starWidth = true;
+    ++p;
+  } else {
+    while (isdigit(static_cast<unsigned char>(*p))) {
+      spec->flags += *p++;
+    }
+  }
+  if (*p == '.') {
+    spec->hasPrec = true;
+    ++p;
+    if (*p == '*') {
+      spec->starPrec = true;
+      ++p;
+    } else {
+      while (isdigit(static_cast<unsigned char>(*p))) {
+        spec->prec += *p++;
+      }
+    }
+  }
+  while (*p && strchr("hlLqjzt", *p)) {
+    ++p;
+  }
+  spec->conv = *p;
+  return *p ? p + 1 : p;
+}
+
+void LogCodec::Parse(Site *site) {
+  site->strBound.clear();
+  const char *p = site->format.c_str();
+  while ((p = strchr(p, '%'))) {
+    Spec spec;
+    p = ParseSpec_(p + 1, &spec);
+    if (spec.conv == '%' || spec.conv == 0) {
+      continue;
+    }
+    if (spec.starWidth) {
+      site->strBound.push_back(-1);
+    }
+    if (spec.starPrec) {
+      site->strBound.push_back(-1);
+    }
+    int bound = -1;
+    if (spec.conv == 's' && spec.hasPrec) {
+      bound = spec.starPrec ? -2 : atoi(spec.prec.c_str());
+    }
+    site->strBound.push_back(bound);
+  }
+}
+
+const char *LogCodec::Title(int level) {
+  switch (level) {
+  case 0:
+    return "[debug]: ";
+  case 2:
+    return "[warn] : ";
+  case 3:
+    return "[error]: ";
+  default:
+    return "[info] : ";
+  }
+}
+
+// 按格式串里的精度只读需要的部分，%.*s的参数不一定以0结尾
+void LogCodec::PutStr_(Encoder &enc, const char *str) {
+  if (!str) {
+    str = "(null)";
+  }
+  long long bound = -1;
+  if (enc.site && enc.index < enc.site->strBound.size()) {
+    bound = enc.site->strBound[enc.index];
+    if (bound == -2) {
+      bound = enc.prev;
+    }
+  }
+  size_t len = bound >= 0 ? strnlen(str, std::min<long long>(bound, INT_MAX))
+                          : strlen(str);
+  // 类型、长度(记录不超过MAX_RECORD，至多2字节)和至少一个字节
+  if (!Reserve_(enc, 4)) {
+    return;
+  }
+  len = std::min(len, static_cast<size_t>(enc.end - enc.pos - 3));
+  *enc.pos++ = TAG_STR;
+  size_t value = len;
+  while (value >= 0x80) {
+    *enc.pos++ = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  *enc.pos++ = static_cast<char>(value);
+  memcpy(enc.pos, str, len);
+  enc.pos += len;
+}
+
+size_t LogCodec::EncodeDefine(char *out, size_t cap, const Site &site) {
+  Encoder enc{out + HEAD_SIZE, out + std::min(cap, MAX_RECORD), nullptr, 0, 0};
+  Put_(enc, site.id);
+  Put_(enc, site.level);
+  Put_(enc, site.file.c_str());
+  Put_(enc, site.line);
+  Put_(enc, site.format.c_str());
+  return Finish_(out, enc.pos, DEFINE_ID, 0);
+}
+
+size_t LogCodec::RecordSize(const char *data, size_t len) {
+  if (len < HEAD_SIZE) {
+    return 0;
+  }
+  uint16_t size;
+  memcpy(&size, data, sizeof(size));
+  if (size < HEAD_SIZE || size > MAX_RECORD || size > len) {
+    return 0;
+  }
+  return size;
+}
+
+LogCodec::LogCodec() : lastSec_(-1), secLen_(0) {}
+
+void LogCodec::Reset() { sites_.clear(); }
+
+void LogCodec::Define(const Site &site) {
+  Compiled &compiled = sites_[site.id];
+  compiled.level = site.level;
+  compiled.pieces.clear();
+  Piece piece;
+  const char *p = site.format.c_str();
+  while (*p) {
+    if (*p != '%') {
+      piece.text.push_back(*p++);
+      continue;
+    }
+    Spec spec;
+    p = ParseSpec_(p + 1, &spec);
+    if (spec.conv == '%') {
+      piece.text.push_back('%');
+      continue;
+    }
+    if (spec.conv == 0) {
+      break;
+    }
+    piece.spec = spec;
+    piece.plain = spec.flags.empty() && !spec.starWidth && !spec.hasPrec;
+    compiled.pieces.push_back(std::move(piece));
+    piece = Piece();
+  }
+  if (!piece.text.empty()) {
+    compiled.pieces.push_back(std::move(piece));
+  }
+}
+
+bool LogCodec::GetVar_(const char *&p, const char *end, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*p++);
+    *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool LogCodec::Decode(const char *data, size_t size, std::string *text) {
+  uint32_t id;
+  uint64_t ns;
+  memcpy(&id, data + 2, sizeof(id));
+  memcpy(&ns, data + 6, sizeof(ns));
+
+  size_t argc = 0;
+  const char *p = data + HEAD_SIZE;
+  const char *end = data + size;
+  while (p < end) {
+    if (argc == args_.size()) {
+      args_.emplace_back();
+    }
+    Arg &arg = args_[argc];
+    arg.tag = static_cast<uint8_t>(*p++);
+    arg.u = 0;
+    arg.d = 0;
+    bool ok = true;
+    if (arg.tag == TAG_INT || arg.tag == TAG_UINT || arg.tag == TAG_PTR) {
+      ok = GetVar_(p, end, &arg.u);
+      if (arg.tag == TAG_INT) {
+        arg.u = (arg.u >> 1) ^ (~(arg.u & 1) + 1);
+      }
+    } else if (arg.tag == TAG_DOUBLE) {
+      ok = end - p >= static_cast<long>(sizeof(arg.d));
+      if (ok) {
+        memcpy(&arg.d, p, sizeof(arg.d));
+        p += sizeof(arg.d);
+      }
+    } else if (arg.tag == TAG_STR) {
+      uint64_t len;
+      ok = GetVar_(p, end, &len) && len <= static_cast<uint64_t>(end - p);
+      if (ok) {
+        arg.s.assign(p, len);
+        p += len;
+      }
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      break;
+    }
+    ++argc;
+  }
+
+  if (id == DEFINE_ID) {
+    if (argc == 5 && args_[2].tag == TAG_STR && args_[4].tag == TAG_STR) {
+      Site site;
+      site.id = static_cast<uint32_t>(args_[0].u);
+      site.level = static_cast<int>(static_cast<int64_t>(args_[1].u));
+      site.file = args_[2].s;
+      site.line = static_cast<int>(static_cast<int64_t>(args_[3].u));
+      site.format = args_[4].s;
+      Define(site);
+    }
+    return false;
+  }
+  Stamp_(ns, text);
+  auto it = sites_.find(id);
+  if (it == sites_.end()) {
+    text->append(Title(1));
+    Append(text, "<unknown log site %u>\n", id);
+    return true;
+  }
+  Format_(it->second, argc, text);
+  return true;
+}
+
+void LogCodec::Stamp_(uint64_t ns, std::string *text) {
+  time_t sec = static_cast<time_t>(ns / 1000000000);
+  if (sec != lastSec_) {
+    struct tm sysTime;
+    localtime_r(&sec, &sysTime);
+    secLen_ = snprintf(secPrefix_, sizeof(secPrefix_),
+                       "%d-%02d-%02d %02d:%02d:%02d", sysTime.tm_year + 1900,
+                       sysTime.tm_mon + 1, sysTime.tm_mday, sysTime.tm_hour,
+                       sysTime.tm_min, sysTime.tm_sec);
+    lastSec_ = sec;
+  }
+  text->append(secPrefix_, secLen_);
+  Append(text, ".%06ld ", static_cast<long>(ns % 1000000000 / 1000));
+}
+
+// 逐个说明符把参数按记录里的实际类型输出，参数不够或类型不符时输出<?>。
+// 没有标志、宽度和精度的整数和字符串直接追加，其余交给snprintf
+void LogCodec::Format_(const Compiled &site, size_t argc, std::string *text) {
+  text->append(Title(site.level));
+  size_t next = 0;
+  auto asInt = [](const Arg &arg) -> long long {
+    if (arg.tag == TAG_DOUBLE) {
+      return static_cast<long long>(arg.d);
+    }
+    return arg.tag == TAG_STR ? 0 : static_cast<long long>(arg.u);
+  };
+  auto asDouble = [](const Arg &arg) -> double {
+    if (arg.tag == TAG_DOUBLE) {
+      return arg.d;
+    }
+    return arg.tag == TAG_INT ? static_cast<double>(static_cast<int64_t>(arg.u))
+                              : static_cast<double>(arg.u);
+  };
+  auto take = [&]() -> const Arg * {
+    return next < argc ? &args_[next++] : nullptr;
+  };
+
+  for (const Piece &piece : site.pieces) {
+    text->append(piece.text);
+    const Spec &spec = piece.spec;
+    if (spec.conv == 0) {
+      continue;
+    }
+    std::string fmt;
+    if (!piece.plain) {
+      fmt = "%" + spec.flags;
+      if (spec.starWidth) {
+        const Arg *width = take();
+        fmt += std::to_string(width ? asInt(*width) : 0);
+      }
+      if (spec.hasPrec) {
+        fmt += '.';
+        if (spec.starPrec) {
+          const Arg *prec = take();
+          fmt += std::to_string(prec ? asInt(*prec) : 0);
+        } else {
+          fmt += spec.prec;
+        }
+      }
+    }
+    const Arg *arg = take();
+    if (!arg) {
+      text->append("<?>");
+      continue;
+    }
+    if (piece.plain) {
+      if (spec.conv == 's' && arg->tag == TAG_STR) {
+        text->append(arg->s);
+        continue;
+      }
+      if (spec.conv == 'd' || spec.conv == 'i') {
+        long long value = asInt(*arg);
+        AppendInt(text,
+                  value < 0 ? 0ULL - static_cast<unsigned long long>(value)
+                            : static_cast<unsigned long long>(value),
+                  value < 0);
+        continue;
+      }
+      if (spec.conv == 'u') {
+        AppendInt(text, static_cast<unsigned long long>(asInt(*arg)), false);
+        continue;
+      }
+      fmt = "%";
+    }
+    switch (spec.conv) {
+    case 'd':
+    case 'i':
+      Append(text, fmt + "lld", asInt(*arg));
+      break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      Append(text, fmt + "ll" + spec.conv,
+             static_cast<unsigned long long>(asInt(*arg)));
+      break;
+    case 'c':
+      Append(text, fmt + 'c', static_cast<int>(asInt(*arg)));
+      break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      Append(text, fmt + spec.conv, asDouble(*arg));
+      break;
+    case 's':
+      if (arg->tag == TAG_STR) {
+        Append(text, fmt + 's', arg->s.c_str());
+      } else {
+        text->append("<?>");
+      }
+      break;
+    case 'p':
+      Append(text, fmt + 'p',
+             reinterpret_cast<void *>(static_cast<uintptr_t>(arg->u)));
+      break;
+    default:
+      text->append("<?>");
+      break;
+    }
+  }
+  text->push_back('\n');
+}
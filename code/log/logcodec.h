@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// 延迟格式化的二进制日志记录。调用点只写调用点编号、时间和原始参数，
+// 格式化留给写线程或离线的logdecoder。
+// 记录：size(2) id(4) ns(8)，之后每个参数一个类型字节加内容，整数用varint。
+// 调用点定义也是一条记录(id为DEFINE_ID)，参数依次为编号、等级、文件、行号、格式串；
+// 二进制文件以MAGIC开头，随后写出已登记的调用点，进程重启追加时再写一次MAGIC
+class LogCodec {
+public:
+  // 调用点，格式串在登记时解析一次
+  struct Site {
+    uint32_t id;
+    int level;
+    std::string file;
+    int line;
+    std::string format;
+    // 各参数作为%s输出时的最大长度：-1不限，-2取前一个参数(%.*s)，其余为精度
+    std::vector<int> strBound;
+  };
+
+  enum TAG : uint8_t { TAG_INT = 1, TAG_UINT, TAG_DOUBLE, TAG_STR, TAG_PTR };
+
+  static constexpr char MAGIC[8] = {'W', 'S', 'L', 'O', 'G', 'B', '1', '\n'};
+  static const uint32_t DEFINE_ID = 0xFFFFFFFF;
+  static const size_t HEAD_SIZE = 14;
+  static const size_t MAX_RECORD = 4096;
+
+  static void Parse(Site *site);
+  static const char *Title(int level);
+
+  // 编码到out，返回记录长度；放不下的字符串截断，放不下的数值及其后的参数丢弃
+  template <typename... Args>
+  static size_t Encode(char *out, size_t cap, const Site &site, uint64_t ns,
+                       const Args &...args) {
+    Encoder enc{out + HEAD_SIZE, out + std::min(cap, MAX_RECORD), &site, 0,
+                0};
+    (Put_(enc, args), ...);
+    return Finish_(out, enc.pos, site.id, ns);
+  }
+  static size_t EncodeDefine(char *out, size_t cap, const Site &site);
+  // data开头一条完整记录的长度，不完整或损坏时返回0
+  static size_t RecordSize(const char *data, size_t len);
+  static uint64_t Time(const char *record) {
+    uint64_t ns;
+    memcpy(&ns, record + 6, sizeof(ns));
+    return ns;
+  }
+  static void SetTime(char *record, uint64_t ns) {
+    memcpy(record + 6, &ns, sizeof(ns));
+  }
+
+  LogCodec();
+  void Reset();
+  void Define(const Site &site);
+  // 解码一条记录：日志行追加到text并返回true，调用点定义只登记
+  bool Decode(const char *data, size_t size, std::string *text);
+
+private:
+  struct Encoder {
+    char *pos;
+    char *end;
+    const Site *site;
+    size_t index;
+    long long prev; // 上一个整数参数，%.*s的长度
+  };
+
+  struct Arg {
+    uint8_t tag;
+    uint64_t u;
+    double d;
+    std::string s;
+  };
+
+  // 一个转换说明符，长度修饰符解码时按实际参数类型重写
+  struct Spec {
+    std::string flags; // 标志和数字宽度
+    bool starWidth = false;
+    bool hasPrec = false;
+    bool starPrec = false;
+    std::string prec;
+    char conv = 0;
+  };
+
+  // 解码用：格式串在登记时切成文本和说明符，plain表示没有标志、宽度和精度
+  struct Piece {
+    std::string text;
+    Spec spec;
+    bool plain;
+  };
+  struct Compiled {
+    int level;
+    std::vector<Piece> pieces;
+  };
+
+  // 编码在调用点执行，都放在头文件里内联
+  static size_t Finish_(char *out, char *pos, uint32_t id, uint64_t ns) {
+    uint16_t size = static_cast<uint16_t>(pos - out);
+    memcpy(out, &size, sizeof(size));
+    memcpy(out + 2, &id, sizeof(id));
+    memcpy(out + 6, &ns, sizeof(ns));
+    return size;
+  }
+
+  // 空间不够时截断：之后的参数都不再写入
+  static bool Reserve_(Encoder &enc, size_t bytes) {
+    if (static_cast<size_t>(enc.end - enc.pos) < bytes) {
+      enc.end = enc.pos;
+      return false;
+    }
+    return true;
+  }
+
+  static void PutVar_(Encoder &enc, uint8_t tag, uint64_t value) {
+    if (!Reserve_(enc, 11)) {
+      return;
+    }
+    *enc.pos++ = static_cast<char>(tag);
+    while (value >= 0x80) {
+      *enc.pos++ = static_cast<char>(value | 0x80);
+      value >>= 7;
+    }
+    *enc.pos++ = static_cast<char>(value);
+  }
+
+  static void PutDouble_(Encoder &enc, double value) {
+    if (!Reserve_(enc, 1 + sizeof(value))) {
+      return;
+    }
+    *enc.pos++ = TAG_DOUBLE;
+    memcpy(enc.pos, &value, sizeof(value));
+    enc.pos += sizeof(value);
+  }
+
+  static void PutStr_(Encoder &enc, const char *str);
+
+  template <typename T> static void Put_(Encoder &enc, const T &value) {
+    if constexpr (std::is_enum<T>::value) {
+      Put_(enc, static_cast<typename std::underlying_type<T>::type>(value));
+      return;
+    } else if constexpr (std::is_integral<T>::value) {
+      if constexpr (std::is_signed<T>::value) {
+        long long v = value;
+        enc.prev = v;
+        // zigzag，小的负数也只占一两个字节
+        PutVar_(enc, TAG_INT,
+                static_cast<uint64_t>(v) << 1 ^ static_cast<uint64_t>(v >> 63));
+      } else {
+        enc.prev = static_cast<long long>(value);
+        PutVar_(enc, TAG_UINT, value);
+      }
+    } else if constexpr (std::is_floating_point<T>::value) {
+      PutDouble_(enc, value);
+    } else if constexpr (std::is_convertible<const T &, const char *>::value) {
+      PutStr_(enc, value);
+    } else if constexpr (std::is_same<T, std::string>::value) {
+      PutStr_(enc, value.c_str());
+    } else {
+      static_assert(std::is_pointer<T>::value, "unsupported log argument");
+      PutVar_(enc, TAG_PTR, reinterpret_cast<uintptr_t>(value));
+    }
+    ++enc.index;
+  }
+
+  static const char *ParseSpec_(const char *p, Spec *spec);
+  static bool GetVar_(const char *&p, const char *end, uint64_t *value);
+  void Stamp_(uint64_t ns, std::string *text);
+  void Format_(const Compiled &site, size_t argc, std::string *text);
+
+  std::unordered_map<uint32_t, Compiled> sites_;
+  std::vector<Arg> args_; // 解码时复用
+  time_t lastSec_;
+  char secPrefix_[32];
+  size_t secLen_;
+};
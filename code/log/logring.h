@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+// 单生产者单消费者的字节环形缓冲区，容量为2的幂，预先分配。
+// 生产者整条写入后才发布tail，消费者看到的总是完整的记录；
+// 空间不足时整条放弃，从不阻塞生产者
+class LogRing {
+public:
+  explicit LogRing(size_t capacity)
+      : buf_(new char[capacity]), mask_(capacity - 1), headCache_(0) {
+    assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+  }
+  LogRing(const LogRing &) = delete;
+  LogRing &operator=(const LogRing &) = delete;
+
+  // 生产者调用
+  bool TryWrite(const char *data, size_t len) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    // 先用缓存的head判断，不够时才去读消费者的cache line
+    if (tail + len - headCache_ > Capacity()) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      if (tail + len - headCache_ > Capacity()) {
+        return false;
+      }
+    }
+    size_t pos = tail & mask_;
+    size_t first = std::min(len, Capacity() - pos);
+    memcpy(buf_.get() + pos, data, first);
+    if (first < len) {
+      memcpy(buf_.get(), data + first, len - first);
+    }
+    tail_.store(tail + len, std::memory_order_release);
+    return true;
+  }
+
+  // 生产者调用：已用空间是否过半。缓存的head显示过半时才读一次真实值
+  bool OverHalf() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - headCache_ <= Capacity() / 2) {
+      return false;
+    }
+    headCache_ = head_.load(std::memory_order_acquire);
+    return tail - headCache_ > Capacity() / 2;
+  }
+
+  // 消费者调用：可读内容按至多两段(绕回处断开)交给sink，返回字节数
+  template <typename Sink> size_t Drain(Sink &&sink) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t len = tail - head;
+    if (len == 0) {
+      return 0;
+    }
+    size_t pos = head & mask_;
+    size_t first = std::min(len, Capacity() - pos);
+    sink(buf_.get() + pos, first);
+    if (first < len) {
+      sink(buf_.get(), len - first);
+    }
+    head_.store(tail, std::memory_order_release);
+    return len;
+  }
+
+  // 并发下只是近似值
+  size_t Size() const {
+    return tail_.load(std::memory_order_relaxed) -
+           head_.load(std::memory_order_relaxed);
+  }
+  size_t Capacity() const { return mask_ + 1; }
+
+private:
+  std::unique_ptr<char[]> buf_;
+  size_t mask_;
+  // 生产者和消费者的下标放在不同的cache line
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+  size_t headCache_; // 生产者私有
+};
@@ -2,7 +2,11 @@
 #include <unistd.h>
 
 int main() {
-  WebServer sever(1234, 3, 30000, 3306, "user", "password", "webserver", 16, 16,
-                  true, 1, 1024);
+  // 端口 ET模式 timeoutMs
+  // Mysql配置 用户存储文件(非空时不用MySQL) 连接池上限 线程池数量
+  // reactor数量（0为单reactor + 线程池） io_uring开关 sendfile开关
+  // 日志开关 日志等级 日志异步队列容量 日志模式(TEXT/DEFERRED/BINARY)
+  WebServer sever(1234, 3, 30000, 3306, "user", "password", "webserver",
+                  nullptr, 16, 16, 0, false, true, true, 1, 1024, Log::TEXT);
   sever.Start();
 }
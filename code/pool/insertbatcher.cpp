@@ -0,0 +1,129 @@
+#include "insertbatcher.h"
+
+InsertBatcher::InsertBatcher(std::string prefix, size_t columns,
+                             size_t maxBatch, size_t maxInFlight,
+                             size_t maxPending)
+    : prefix_(std::move(prefix)), columns_(columns), maxBatch_(maxBatch),
+      maxInFlight_(maxInFlight), maxPending_(maxPending) {
+  assert(columns_ > 0 && maxBatch_ > 0 && maxInFlight_ > 0);
+}
+
+bool InsertBatcher::Add(std::vector<std::string> row, Callback done) {
+  assert(row.size() == columns_);
+  Batch batch;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (pending_.size() >= maxPending_) {
+      return false;
+    }
+    pending_.push_back({std::move(row), std::move(done)});
+    if (inFlight_ >= maxInFlight_) {
+      return true;
+    }
+    ++inFlight_;
+    batch = Take_();
+  }
+  Submit_(std::move(batch));
+  return true;
+}
+
+// 调用方持有mtx_
+InsertBatcher::Batch InsertBatcher::Take_() {
+  Batch batch = std::make_shared<std::vector<Row>>();
+  if (pending_.size() <= maxBatch_) {
+    batch->swap(pending_);
+  } else {
+    batch->assign(std::make_move_iterator(pending_.begin()),
+                  std::make_move_iterator(pending_.begin() + maxBatch_));
+    pending_.erase(pending_.begin(), pending_.begin() + maxBatch_);
+  }
+  return batch;
+}
+
+std::string InsertBatcher::Sql_(size_t rows) const {
+  std::string group = "(?";
+  for (size_t i = 1; i < columns_; ++i) {
+    group += ",?";
+  }
+  group += ")";
+  std::string sql = prefix_;
+  for (size_t i = 0; i < rows; ++i) {
+    sql += i ? "," : " ";
+    sql += group;
+  }
+  return sql;
+}
+
+// 批内重复的键先失败掉，剩下的拼成一条语句
+void InsertBatcher::Submit_(Batch batch) {
+  Batch rows = std::make_shared<std::vector<Row>>();
+  std::vector<Row> dups;
+  std::unordered_set<std::string> keys;
+  for (Row &row : *batch) {
+    if (keys.insert(row.values[0]).second) {
+      rows->push_back(std::move(row));
+    } else {
+      dups.push_back(std::move(row));
+    }
+  }
+  SqlResult dup;
+  dup.err = ER_DUP_ENTRY;
+  for (Row &row : dups) {
+    row.done(dup);
+  }
+  std::vector<std::string> params;
+  params.reserve(rows->size() * columns_);
+  for (Row &row : *rows) {
+    for (std::string &value : row.values) {
+      params.push_back(value);
+    }
+  }
+  LOG_DEBUG("Insert batch of %zu rows", rows->size());
+  bool queued = SqlAsync::Instance()->Execute(
+      Sql_(rows->size()), std::move(params),
+      [this, rows](const SqlResult &res) { OnBatch_(rows, res); });
+  if (!queued) {
+    SqlResult res;
+    res.busy = true;
+    OnBatch_(rows, res);
+  }
+}
+
+void InsertBatcher::OnBatch_(const Batch &batch, const SqlResult &res) {
+  if (!res.ok && res.err == ER_DUP_ENTRY && batch->size() > 1) {
+    LOG_DEBUG("Insert batch conflict, retry %zu rows", batch->size());
+    for (Row &row : *batch) {
+      Retry_(row);
+    }
+  } else {
+    for (Row &row : *batch) {
+      row.done(res);
+    }
+  }
+  Done_();
+}
+
+// 单独重试的行不占批的名额
+void InsertBatcher::Retry_(Row &row) {
+  Callback done = row.done;
+  if (!SqlAsync::Instance()->Execute(Sql_(1), std::move(row.values),
+                                     std::move(row.done))) {
+    SqlResult res;
+    res.busy = true;
+    done(res);
+  }
+}
+
+// 一批完成后把这期间排队的行作为下一批提交
+void InsertBatcher::Done_() {
+  Batch batch;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (pending_.empty()) {
+      --inFlight_;
+      return;
+    }
+    batch = Take_();
+  }
+  Submit_(std::move(batch));
+}
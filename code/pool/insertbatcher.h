@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../log/log.h"
+#include "sqlasync.h"
+
+// 把多个请求各自的单行INSERT合并成一条多行INSERT，整批在一个事务里提交，
+// 只刷一次盘。空闲时到达的行立即提交；已有maxInFlight批在执行时新到的行排队，
+// 前一批完成后一起提交，批的大小随数据库延迟和到达速率自动变化(group commit)。
+// 第一列作为键：同一批里键重复的行只保留先到的，其余按ER_DUP_ENTRY失败；
+// 整批因键冲突失败时逐行重试，每行得到自己的结果。回调在SqlAsync的事件线程执行
+class InsertBatcher {
+public:
+  typedef SqlAsync::Callback Callback;
+
+  // prefix如"INSERT INTO t(a, b) VALUES"，columns为每行的列数
+  InsertBatcher(std::string prefix, size_t columns, size_t maxBatch,
+                size_t maxInFlight, size_t maxPending);
+  InsertBatcher(const InsertBatcher &) = delete;
+  InsertBatcher &operator=(const InsertBatcher &) = delete;
+
+  // 排队已满时返回false，不会调用done
+  bool Add(std::vector<std::string> row, Callback done);
+
+private:
+  struct Row {
+    std::vector<std::string> values;
+    Callback done;
+  };
+  typedef std::shared_ptr<std::vector<Row>> Batch;
+
+  Batch Take_();
+  void Submit_(Batch batch);
+  void OnBatch_(const Batch &batch, const SqlResult &res);
+  void Retry_(Row &row);
+  void Done_();
+  std::string Sql_(size_t rows) const;
+
+  const std::string prefix_;
+  const size_t columns_;
+  const size_t maxBatch_;
+  const size_t maxInFlight_;
+  const size_t maxPending_;
+
+  std::mutex mtx_;
+  std::vector<Row> pending_;
+  size_t inFlight_ = 0;
+};
@@ -0,0 +1,587 @@
+#include "sqlasync.h"
+
+namespace {
+
+#ifndef LIBMARIADB
+#warning "MySQL client has no non-blocking API (need MariaDB Connector/C): \
+SqlAsync falls back to blocking worker threads"
+// 没有非阻塞接口时用阻塞调用代替，总是立即完成，_cont不会被调用；
+// 查询由Work_线程执行，不经过事件线程
+const int MYSQL_WAIT_READ = 1;
+const int MYSQL_WAIT_WRITE = 2;
+const int MYSQL_WAIT_EXCEPT = 4;
+const int MYSQL_WAIT_TIMEOUT = 8;
+
+int mysql_real_query_start(int *ret, MYSQL *sql, const char *q,
+                           unsigned long len) {
+  *ret = mysql_real_query(sql, q, len);
+  return 0;
+}
+int mysql_store_result_start(MYSQL_RES **ret, MYSQL *sql) {
+  *ret = mysql_store_result(sql);
+  return 0;
+}
+int mysql_stmt_prepare_start(int *ret, MYSQL_STMT *stmt, const char *q,
+                             unsigned long len) {
+  *ret = mysql_stmt_prepare(stmt, q, len);
+  return 0;
+}
+int mysql_stmt_execute_start(int *ret, MYSQL_STMT *stmt) {
+  *ret = mysql_stmt_execute(stmt);
+  return 0;
+}
+int mysql_stmt_store_result_start(int *ret, MYSQL_STMT *stmt) {
+  *ret = mysql_stmt_store_result(stmt);
+  return 0;
+}
+int mysql_real_query_cont(int *, MYSQL *, int) { return 0; }
+int mysql_store_result_cont(MYSQL_RES **, MYSQL *, int) { return 0; }
+int mysql_stmt_prepare_cont(int *, MYSQL_STMT *, int) { return 0; }
+int mysql_stmt_execute_cont(int *, MYSQL_STMT *, int) { return 0; }
+int mysql_stmt_store_result_cont(int *, MYSQL_STMT *, int) { return 0; }
+#endif
+
+} // namespace
+
+SqlAsync *SqlAsync::Instance() {
+  static SqlAsync client;
+  return &client;
+}
+
+bool SqlAsync::Init(int maxInFlight, size_t maxPending, int acquireMS) {
+  assert(maxInFlight > 0 && !isRunning_);
+  slots_.resize(maxInFlight);
+  maxPending_ = maxPending;
+  acquireTimeout_ = std::chrono::milliseconds(acquireMS);
+#ifdef LIBMARIADB
+  wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd_ < 0) {
+    LOG_ERROR("SqlAsync eventfd error!");
+    return false;
+  }
+  poller_ = Poller::Create(false);
+  poller_->AddFd(wakeFd_, EPOLLIN);
+  timer_.reset(new TimingWheel(
+      std::bind(&SqlAsync::OnTimeout_, this, std::placeholders::_1)));
+  isRunning_ = true;
+  thread_ = std::thread(&SqlAsync::Loop_, this);
+#else
+  isRunning_ = true;
+  for (int id = 0; id < maxInFlight; ++id) {
+    workers_.emplace_back(&SqlAsync::Work_, this, id);
+  }
+  LOG_ERROR("SqlAsync: client library has no non-blocking API, queries block "
+            "%d worker threads; link MariaDB Connector/C",
+            maxInFlight);
+#endif
+  return true;
+}
+
+bool SqlAsync::Query(std::string sql, Callback done) {
+  return Submit_({std::move(sql), {}, false, std::move(done), {}});
+}
+
+bool SqlAsync::Execute(std::string sql, std::vector<std::string> params,
+                       Callback done) {
+  return Submit_(
+      {std::move(sql), std::move(params), true, std::move(done), {}});
+}
+
+bool SqlAsync::Submit_(Job &&job) {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!isRunning_ || pending_.size() >= maxPending_) {
+      return false;
+    }
+    job.queued = Clock::now();
+    pending_.push_back(std::move(job));
+  }
+#ifdef LIBMARIADB
+  uint64_t one = 1;
+  if (write(wakeFd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    LOG_WARN("SqlAsync wakeup error!");
+  }
+#else
+  jobCond_.notify_one();
+#endif
+  return true;
+}
+
+void SqlAsync::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!isRunning_) {
+      return;
+    }
+    isRunning_ = false;
+    pending_.clear();
+  }
+#ifdef LIBMARIADB
+  uint64_t one = 1;
+  if (write(wakeFd_, &one, sizeof(one)) < 0) {
+    LOG_WARN("SqlAsync wakeup error!");
+  }
+  thread_.join();
+  for (Slot &slot : slots_) {
+    if (slot.sql) {
+      Release_(slot);
+    }
+  }
+  poller_.reset();
+  close(wakeFd_);
+  wakeFd_ = -1;
+#else
+  // 执行中的查询做完才退出，槽位都已归还
+  jobCond_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+#endif
+}
+
+size_t SqlAsync::Pending() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return pending_.size();
+}
+
+void SqlAsync::Loop_() {
+  while (isRunning_) {
+    Assign_();
+    int timeMS = timer_->GetNextTick();
+    if (starved_ && (timeMS < 0 || timeMS > RETRY_MS)) {
+      timeMS = RETRY_MS;
+    }
+    int eventCnt = poller_->Wait(timeMS);
+    for (int i = 0; i < eventCnt; ++i) {
+      int fd = poller_->GetEventFd(i);
+      uint32_t events = poller_->GetEvents(i);
+      if (fd == wakeFd_) {
+        uint64_t cnt;
+        if (read(wakeFd_, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+          LOG_WARN("SqlAsync wakeup read error!");
+        }
+        continue;
+      }
+      auto it = fdSlot_.find(fd);
+      if (it == fdSlot_.end()) {
+        continue;
+      }
+      int ready = 0;
+      if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        ready |= MYSQL_WAIT_READ;
+      }
+      if (events & EPOLLOUT) {
+        ready |= MYSQL_WAIT_WRITE;
+      }
+      if (events & EPOLLPRI) {
+        ready |= MYSQL_WAIT_EXCEPT;
+      }
+      timer_->del(it->second);
+      Step_(it->second, ready);
+    }
+  }
+}
+
+// 阻塞执行：每个线程固定使用一个槽位，排队期限内等连接，
+// 之后与事件线程走同样的步骤，每一步都立即完成
+void SqlAsync::Work_(int id) {
+  Slot &slot = slots_[id];
+  SqlConnPool *pool = SqlConnPool::Instance();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      jobCond_.wait(lock, [this] { return !isRunning_ || !pending_.empty(); });
+      if (!isRunning_) {
+        return;
+      }
+      slot.job = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        slot.job.queued + acquireTimeout_ - Clock::now());
+    slot.sql = pool->GetConn(left.count() > 0 ? static_cast<int>(left.count())
+                                              : 0);
+    if (slot.sql) {
+      Begin_(id);
+      continue;
+    }
+    SqlResult result;
+    result.busy = true;
+    Callback done = std::move(slot.job.done);
+    slot.job = Job();
+    done(result);
+  }
+}
+
+// 把排队的查询分给空闲槽位，只有本线程出队，检查和取出之间不会被抢走
+void SqlAsync::Assign_() {
+  SqlConnPool *pool = SqlConnPool::Instance();
+  for (size_t id = 0; id < slots_.size(); ++id) {
+    Slot &slot = slots_[id];
+    if (slot.sql) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (pending_.empty()) {
+        break;
+      }
+    }
+    slot.sql = pool->TryGetConn();
+    if (!slot.sql) {
+      break;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      slot.job = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    pool->RecordWait(std::chrono::duration_cast<std::chrono::microseconds>(
+                         Clock::now() - slot.job.queued)
+                         .count(),
+                     false);
+    Begin_(static_cast<int>(id));
+  }
+  Expire_();
+}
+
+// 没分到连接的查询超过期限就以busy结束；仍有排队时Loop_定时回来重试
+void SqlAsync::Expire_() {
+  std::vector<Job> expired;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    Clock::time_point deadline = Clock::now() - acquireTimeout_;
+    while (!pending_.empty() && pending_.front().queued <= deadline) {
+      expired.push_back(std::move(pending_.front()));
+      pending_.pop_front();
+    }
+    starved_ = !pending_.empty();
+  }
+  if (expired.empty()) {
+    return;
+  }
+  LOG_WARN("SqlAsync: %zu queries timed out waiting for a connection",
+           expired.size());
+  SqlResult result;
+  result.busy = true;
+  for (Job &job : expired) {
+    SqlConnPool::Instance()->RecordWait(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                              job.queued)
+            .count(),
+        true);
+    job.done(result);
+  }
+}
+
+// 预处理语句先查连接上的缓存，命中时直接执行。
+// step先设好：出错结束时Release_按它判断语句是否在缓存里
+void SqlAsync::Begin_(int id) {
+  Slot &slot = slots_[id];
+  slot.retried = false;
+  if (!slot.job.prepared) {
+    slot.step = QUERY;
+  } else {
+    slot.stmt = SqlConnPool::Instance()->GetStmt(slot.sql, slot.job.sql);
+    if (slot.stmt) {
+      slot.step = EXECUTE;
+      if (!BindParams_(slot)) {
+        Finish_(id, false);
+        return;
+      }
+    } else {
+      slot.step = PREPARE;
+      slot.stmt = mysql_stmt_init(slot.sql);
+      if (!slot.stmt) {
+        LOG_ERROR("mysql_stmt_init error: %s", mysql_error(slot.sql));
+        Finish_(id, false);
+        return;
+      }
+    }
+  }
+  Step_(id, 0);
+}
+
+// ready为0表示开始当前步骤，否则为已就绪的MYSQL_WAIT_*
+void SqlAsync::Step_(int id, int ready) {
+  Slot &slot = slots_[id];
+  const std::string &sql = slot.job.sql;
+  while (true) {
+    int status = 0;
+    int err = 0;
+    switch (slot.step) {
+    case QUERY:
+      status = ready ? mysql_real_query_cont(&err, slot.sql, ready)
+                     : mysql_real_query_start(&err, slot.sql, sql.data(),
+                                              sql.size());
+      break;
+    case STORE:
+      status = ready ? mysql_store_result_cont(&slot.res, slot.sql, ready)
+                     : mysql_store_result_start(&slot.res, slot.sql);
+      break;
+    case PREPARE:
+      status = ready ? mysql_stmt_prepare_cont(&err, slot.stmt, ready)
+                     : mysql_stmt_prepare_start(&err, slot.stmt, sql.data(),
+                                                sql.size());
+      break;
+    case EXECUTE:
+      status = ready ? mysql_stmt_execute_cont(&err, slot.stmt, ready)
+                     : mysql_stmt_execute_start(&err, slot.stmt);
+      break;
+    case STMT_STORE:
+      status = ready ? mysql_stmt_store_result_cont(&err, slot.stmt, ready)
+                     : mysql_stmt_store_result_start(&err, slot.stmt);
+      break;
+    }
+    if (status) {
+      Wait_(id, status);
+      return;
+    }
+    if (!Next_(id, err)) {
+      return;
+    }
+    ready = 0;
+  }
+}
+
+// 当前步骤完成，决定下一步；返回false表示已结束
+bool SqlAsync::Next_(int id, int err) {
+  Slot &slot = slots_[id];
+  switch (slot.step) {
+  case QUERY:
+    if (err) {
+      LOG_ERROR("Query error: %s", mysql_error(slot.sql));
+      break;
+    }
+    slot.step = STORE;
+    return true;
+  case STORE:
+    // INSERT等没有结果集的语句res为空且field_count为0
+    Finish_(id, slot.res || mysql_field_count(slot.sql) == 0);
+    return false;
+  case PREPARE:
+    // 失败的语句留到Release_再关闭，Finish_还要从它取错误码
+    if (err) {
+      if (Reprepare_(slot)) {
+        return true;
+      }
+      LOG_ERROR("Prepare error: %s", mysql_stmt_error(slot.stmt));
+      break;
+    }
+    // 进了缓存就归连接所有，之后出错也不能再关闭
+    slot.step = EXECUTE;
+    SqlConnPool::Instance()->PutStmt(slot.sql, slot.job.sql, slot.stmt);
+    if (!BindParams_(slot)) {
+      break;
+    }
+    return true;
+  case EXECUTE:
+    if (err) {
+      if (Reprepare_(slot)) {
+        return true;
+      }
+      LOG_ERROR("Execute error: %s", mysql_stmt_error(slot.stmt));
+      break;
+    }
+    if (mysql_stmt_field_count(slot.stmt) == 0) {
+      Finish_(id, true);
+      return false;
+    }
+    slot.step = STMT_STORE;
+    return true;
+  case STMT_STORE:
+    if (err) {
+      LOG_ERROR("Store result error: %s", mysql_stmt_error(slot.stmt));
+      break;
+    }
+    Finish_(id, true);
+    return false;
+  }
+  Finish_(id, false);
+  return false;
+}
+
+// 服务端已不认识这个句柄(如重连、表结构变化)时换一个新句柄重新准备，
+// 只试一次；返回false时slot.stmt仍是出错的句柄
+bool SqlAsync::Reprepare_(Slot &slot) {
+  unsigned int code = mysql_stmt_errno(slot.stmt);
+  if (slot.retried ||
+      (code != ER_UNKNOWN_STMT_HANDLER && code != ER_NEED_REPREPARE)) {
+    return false;
+  }
+  MYSQL_STMT *stmt = mysql_stmt_init(slot.sql);
+  if (!stmt) {
+    return false;
+  }
+  LOG_WARN("Statement expired, prepare again: %s", slot.job.sql.c_str());
+  if (slot.step == PREPARE) {
+    mysql_stmt_close(slot.stmt);
+  } else {
+    SqlConnPool::Instance()->DropStmt(slot.sql, slot.job.sql);
+  }
+  slot.retried = true;
+  slot.stmt = stmt;
+  slot.step = PREPARE;
+  return true;
+}
+
+bool SqlAsync::BindParams_(Slot &slot) {
+  std::vector<std::string> &params = slot.job.params;
+  if (mysql_stmt_param_count(slot.stmt) != params.size()) {
+    LOG_ERROR("Statement expects %lu params, got %zu",
+              mysql_stmt_param_count(slot.stmt), params.size());
+    return false;
+  }
+  slot.binds.assign(params.size(), MYSQL_BIND());
+  slot.lengths.resize(params.size());
+  for (size_t i = 0; i < params.size(); ++i) {
+    slot.lengths[i] = params[i].size();
+    slot.binds[i].buffer_type = MYSQL_TYPE_STRING;
+    slot.binds[i].buffer = const_cast<char *>(params[i].data());
+    slot.binds[i].buffer_length = params[i].size();
+    slot.binds[i].length = &slot.lengths[i];
+  }
+  if (mysql_stmt_bind_param(slot.stmt, slot.binds.data())) {
+    LOG_ERROR("Bind error: %s", mysql_stmt_error(slot.stmt));
+    return false;
+  }
+  return true;
+}
+
+// 结果已由store_result读到本地，逐行取出不再有网络读写。
+// 各列按字符串取，超过初始缓冲区的列截断后用fetch_column补取
+bool SqlAsync::FetchStmt_(Slot &slot, SqlResult *result) {
+  unsigned int fields = mysql_stmt_field_count(slot.stmt);
+  std::vector<MYSQL_BIND> binds(fields, MYSQL_BIND());
+  std::vector<std::string> bufs(fields, std::string(COLUMN_BUF, '\0'));
+  std::vector<unsigned long> lengths(fields);
+  // MySQL 8去掉了my_bool，按绑定结构里的实际类型分配
+  typedef std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type NullFlag;
+  std::unique_ptr<NullFlag[]> isNull(new NullFlag[fields]());
+  for (unsigned int i = 0; i < fields; ++i) {
+    binds[i].buffer_type = MYSQL_TYPE_STRING;
+    binds[i].buffer = &bufs[i][0];
+    binds[i].buffer_length = COLUMN_BUF;
+    binds[i].length = &lengths[i];
+    binds[i].is_null = &isNull[i];
+  }
+  if (mysql_stmt_bind_result(slot.stmt, binds.data())) {
+    LOG_ERROR("Bind result error: %s", mysql_stmt_error(slot.stmt));
+    return false;
+  }
+  int ret;
+  while ((ret = mysql_stmt_fetch(slot.stmt)) == 0 ||
+         ret == MYSQL_DATA_TRUNCATED) {
+    result->rows.emplace_back(fields);
+    std::vector<std::string> &row = result->rows.back();
+    for (unsigned int i = 0; i < fields; ++i) {
+      if (isNull[i]) {
+        continue;
+      }
+      if (lengths[i] <= COLUMN_BUF) {
+        row[i].assign(bufs[i].data(), lengths[i]);
+        continue;
+      }
+      row[i].resize(lengths[i]);
+      MYSQL_BIND col = MYSQL_BIND();
+      col.buffer_type = MYSQL_TYPE_STRING;
+      col.buffer = &row[i][0];
+      col.buffer_length = lengths[i];
+      if (mysql_stmt_fetch_column(slot.stmt, &col, i, 0)) {
+        LOG_ERROR("Fetch column error: %s", mysql_stmt_error(slot.stmt));
+        return false;
+      }
+    }
+  }
+  return ret == MYSQL_NO_DATA;
+}
+
+#ifdef LIBMARIADB
+void SqlAsync::Wait_(int id, int status) {
+  Slot &slot = slots_[id];
+  uint32_t events = EPOLLONESHOT;
+  if (status & MYSQL_WAIT_READ) {
+    events |= EPOLLIN;
+  }
+  if (status & MYSQL_WAIT_WRITE) {
+    events |= EPOLLOUT;
+  }
+  if (status & MYSQL_WAIT_EXCEPT) {
+    events |= EPOLLPRI;
+  }
+  if (slot.fd < 0) {
+    slot.fd = mysql_get_socket(slot.sql);
+    fdSlot_[slot.fd] = id;
+    poller_->AddFd(slot.fd, events);
+  } else {
+    poller_->ModFd(slot.fd, events);
+  }
+  if (status & MYSQL_WAIT_TIMEOUT) {
+    timer_->add(id, static_cast<int>(mysql_get_timeout_value_ms(slot.sql)));
+  }
+}
+#else
+void SqlAsync::Wait_(int, int) {}
+#endif
+
+void SqlAsync::OnTimeout_(int id) {
+  if (slots_[id].sql) {
+    Step_(id, MYSQL_WAIT_TIMEOUT);
+  }
+}
+
+void SqlAsync::Finish_(int id, bool ok) {
+  Slot &slot = slots_[id];
+  SqlResult result;
+  result.ok = ok;
+  if (!ok) {
+    result.err =
+        slot.stmt ? mysql_stmt_errno(slot.stmt) : mysql_errno(slot.sql);
+  }
+  if (slot.res) {
+    unsigned int fields = mysql_num_fields(slot.res);
+    while (MYSQL_ROW row = mysql_fetch_row(slot.res)) {
+      result.rows.emplace_back();
+      for (unsigned int i = 0; i < fields; ++i) {
+        result.rows.back().emplace_back(row[i] ? row[i] : "");
+      }
+    }
+  } else if (ok && slot.step == STMT_STORE) {
+    result.ok = FetchStmt_(slot, &result);
+  }
+  Callback done = std::move(slot.job.done);
+  if (timer_) {
+    timer_->del(id);
+  }
+  Release_(slot);
+  // 回调里可能再提交查询，槽位先归还
+  done(result);
+}
+
+// 连接还给连接池之前从Poller中移除，之后可能被阻塞方式使用。
+// 预处理语句留在连接的缓存里，只释放本次的结果集
+void SqlAsync::Release_(Slot &slot) {
+  if (slot.res) {
+    mysql_free_result(slot.res);
+    slot.res = nullptr;
+  }
+  if (slot.stmt) {
+    // 还没准备完的语句不在缓存里，直接关闭
+    if (slot.step == PREPARE) {
+      mysql_stmt_close(slot.stmt);
+    } else {
+      mysql_stmt_free_result(slot.stmt);
+    }
+    slot.stmt = nullptr;
+  }
+  if (slot.fd >= 0) {
+    poller_->DelFd(slot.fd);
+    fdSlot_.erase(slot.fd);
+    slot.fd = -1;
+  }
+  SqlConnPool::Instance()->FreeConn(slot.sql);
+  slot.sql = nullptr;
+  slot.job = Job();
+  slot.binds.clear();
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <mysql/mysql.h>
+#include <mysql/mysqld_error.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "../epoller/poller.h"
+#include "../log/log.h"
+#include "../timer/timingwheel.h"
+#include "sqlconnpool.h"
+
+// 查询结果：ok为false表示执行出错，err为错误码；rows为结果集的全部行，NULL列为空串
+struct SqlResult {
+  bool ok = false;
+  bool busy = false; // 等连接超过期限，查询没有执行
+  unsigned int err = 0;
+  std::vector<std::vector<std::string>> rows;
+};
+
+// 用MariaDB的非阻塞接口(_start/_cont)执行查询或预处理语句。
+// 连接从SqlConnPool借用，等待中的socket注册到自己的Poller，
+// 一个事件线程同时推进多条连接上的查询，等数据库期间不占用任何线程；
+// 连接都在用时查询排队，排队超过期限的以busy结果结束。
+// 回调在事件线程里执行，应尽快返回，可以在回调里继续提交查询。
+// 非阻塞接口只有MariaDB Connector/C(libmariadb)提供，头文件定义LIBMARIADB；
+// Oracle的libmysqlclient没有，这时每条连接一个线程阻塞执行，
+// 回调在各自的执行线程里调用
+class SqlAsync {
+public:
+  typedef std::function<void(const SqlResult &)> Callback;
+
+  static SqlAsync *Instance();
+
+  // maxInFlight: 同时占用的连接数；maxPending: 排队的查询数上限；
+  // acquireMS: 排队等连接的期限
+  bool Init(int maxInFlight, size_t maxPending, int acquireMS);
+  // 排队已满或未初始化时返回false，不会调用done
+  bool Query(std::string sql, Callback done);
+  // 按预处理语句执行，params依次绑定到'?'。语句在每个连接上首次使用时准备，
+  // 之后复用SqlConnPool里缓存的句柄；服务端报语句失效时重新准备一次
+  bool Execute(std::string sql, std::vector<std::string> params,
+               Callback done);
+  // 未执行完的查询直接丢弃，不调用回调
+  void Close();
+  size_t Pending();
+  // 编译时用的客户端库是否提供非阻塞接口
+  static constexpr bool NonBlocking() {
+#ifdef LIBMARIADB
+    return true;
+#else
+    return false;
+#endif
+  }
+
+private:
+  enum Step {
+    QUERY,      // mysql_real_query
+    STORE,      // mysql_store_result
+    PREPARE,    // mysql_stmt_prepare
+    EXECUTE,    // mysql_stmt_execute
+    STMT_STORE, // mysql_stmt_store_result
+  };
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct Job {
+    std::string sql;
+    std::vector<std::string> params;
+    bool prepared;
+    Callback done;
+    Clock::time_point queued;
+  };
+
+  // 一个执行中的查询，sql为空表示槽位空闲
+  struct Slot {
+    MYSQL *sql = nullptr;
+    int fd = -1; // 已注册到Poller的socket
+    Step step = QUERY;
+    MYSQL_RES *res = nullptr;
+    MYSQL_STMT *stmt = nullptr; // 缓存在SqlConnPool中，这里只借用
+    bool retried = false;
+    std::vector<MYSQL_BIND> binds; // 参数绑定，指向job.params
+    std::vector<unsigned long> lengths;
+    Job job;
+  };
+
+  SqlAsync() = default;
+  ~SqlAsync() { Close(); }
+
+  bool Submit_(Job &&job);
+  void Loop_();
+  void Work_(int id);
+  void Assign_();
+  void Expire_();
+  void Begin_(int id);
+  void Step_(int id, int ready);
+  bool Next_(int id, int err);
+  bool Reprepare_(Slot &slot);
+  bool BindParams_(Slot &slot);
+  bool FetchStmt_(Slot &slot, SqlResult *result);
+  void Wait_(int id, int status);
+  void Finish_(int id, bool ok);
+  void Release_(Slot &slot);
+  void OnTimeout_(int id);
+
+  // 还有查询在排队时隔一段时间再尝试分配连接，并检查排队期限
+  static const int RETRY_MS = 10;
+  // 结果列的初始缓冲区，更长的列截断后单独再取
+  static const unsigned long COLUMN_BUF = 256;
+
+  std::mutex mtx_;
+  std::deque<Job> pending_;
+  size_t maxPending_ = 0;
+  Clock::duration acquireTimeout_{};
+  std::atomic<bool> isRunning_{false};
+  bool starved_ = false;
+  int wakeFd_ = -1;
+  std::vector<Slot> slots_;
+  std::unordered_map<int, int> fdSlot_;
+  std::unique_ptr<Poller> poller_;
+  std::unique_ptr<TimingWheel> timer_;
+  std::thread thread_;
+  // 阻塞执行时使用
+  std::condition_variable jobCond_;
+  std::vector<std::thread> workers_;
+};
@@ -6,57 +6,339 @@ SqlConnPool *SqlConnPool::Instance() {
 }
 
 void SqlConnPool::Init(const char *host, uint16_t port, const char *user,
-                       const char *pwd, const char *dbName, int connSize = 10) {
-  assert(connSize > 0);
-  for (int i = 0; i < connSize; ++i) {
-    MYSQL *conn = nullptr;
-    conn = mysql_init(conn);
-    if (conn) {
-      LOG_ERROR("MySql init error!");
-      assert(conn);
-    }
-    conn = mysql_real_connect(conn, host, user, pwd, dbName, port, nullptr, 0);
+                       const char *pwd, const char *dbName, int minSize,
+                       int maxSize) {
+  assert(maxSize > 0 && isClosed_);
+  host_ = host;
+  port_ = port;
+  user_ = user;
+  pwd_ = pwd;
+  dbName_ = dbName;
+  minSize_ = std::min(std::max(minSize, 0), maxSize);
+  maxSize_ = maxSize;
+  isClosed_ = false;
+  for (int i = 0; i < minSize_; ++i) {
+    MYSQL *conn = Connect_();
     if (!conn) {
-      LOG_ERROR("MySql Connect error!");
+      // 剩下的由后台线程按退避间隔重试
+      break;
     }
-    connQue_.emplace(conn);
+    Clock::time_point now = Clock::now();
+    idle_.push_back({conn, now, now});
+    ++total_;
   }
-  MAX_CONN_ = connSize;
-  sem_init(&semId_, 0, MAX_CONN_);
+  maintainer_ = std::thread(&SqlConnPool::Maintain_, this);
 }
 
-MYSQL *SqlConnPool::GetConn() {
-  MYSQL *conn = nullptr;
-  if (connQue_.empty()) {
+MYSQL *SqlConnPool::Connect_() {
+  MYSQL *conn = mysql_init(nullptr);
+  if (!conn) {
+    LOG_ERROR("MySql init error!");
+    return nullptr;
+  }
+#ifdef LIBMARIADB
+  // 供SqlAsync使用非阻塞接口，阻塞调用不受影响
+  mysql_options(conn, MYSQL_OPT_NONBLOCK, 0);
+#endif
+  unsigned int connectTimeout = CONNECT_TIMEOUT_S;
+  unsigned int ioTimeout = IO_TIMEOUT_S;
+  mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &connectTimeout);
+  mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &ioTimeout);
+  mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, &ioTimeout);
+  if (!mysql_real_connect(conn, host_.c_str(), user_.c_str(), pwd_.c_str(),
+                          dbName_.c_str(), port_, nullptr, 0)) {
+    LOG_ERROR("MySql Connect error: %s", mysql_error(conn));
+    mysql_close(conn);
+    return nullptr;
+  }
+  return conn;
+}
+
+// 连接上缓存的语句先关闭，之后同一地址可能分给新连接
+void SqlConnPool::CloseConn_(MYSQL *conn) {
+  StmtCache cache;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = stmtCache_.find(conn);
+    if (it != stmtCache_.end()) {
+      cache = std::move(it->second);
+      stmtCache_.erase(it);
+    }
+  }
+  CloseStmts_(cache);
+  mysql_close(conn);
+}
+
+MYSQL *SqlConnPool::GetConn(int timeoutMS) {
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline = start + std::chrono::milliseconds(timeoutMS);
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (idle_.empty() && !isClosed_) {
+    if (total_ < maxSize_) {
+      grow_ = true;
+      maintainCond_.notify_one();
+    }
+    if (timeoutMS < 0) {
+      freeCond_.wait(lock);
+    } else if (freeCond_.wait_until(lock, deadline) ==
+               std::cv_status::timeout) {
+      break;
+    }
+  }
+  if (isClosed_) {
+    return nullptr;
+  }
+  int64_t waitUS = std::chrono::duration_cast<std::chrono::microseconds>(
+                       Clock::now() - start)
+                       .count();
+  if (idle_.empty()) {
+    RecordWait_(waitUS, true);
     LOG_WARN("SqlConnPool busy!");
     return nullptr;
   }
-  sem_wait(&semId_);
+  MYSQL *conn = idle_.front().conn;
+  idle_.pop_front();
+  ++acquired_;
+  RecordWait_(waitUS, false);
+  return conn;
+}
+
+MYSQL *SqlConnPool::TryGetConn() {
   std::lock_guard<std::mutex> lock(mtx_);
-  conn = connQue_.front();
-  connQue_.pop();
+  if (idle_.empty()) {
+    if (!isClosed_ && total_ < maxSize_ && !grow_) {
+      grow_ = true;
+      maintainCond_.notify_one();
+    }
+    return nullptr;
+  }
+  MYSQL *conn = idle_.front().conn;
+  idle_.pop_front();
+  ++acquired_;
   return conn;
 }
 
 // 存入连接池
 void SqlConnPool::FreeConn(MYSQL *conn) {
   assert(conn);
+  if (IsLost_(mysql_errno(conn))) {
+    LOG_WARN("MySql connection lost: %s", mysql_error(conn));
+    CloseConn_(conn);
+    std::lock_guard<std::mutex> lock(mtx_);
+    --total_;
+    ++broken_;
+    maintainCond_.notify_one();
+    return;
+  }
+  Clock::time_point now = Clock::now();
   std::lock_guard<std::mutex> lock(mtx_);
-  connQue_.push(conn);
-  sem_post(&semId_);
+  idle_.push_front({conn, now, now});
+  freeCond_.notify_one();
+}
+
+bool SqlConnPool::IsLost_(unsigned int err) {
+  return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+// 建连放在锁外，期间其他线程照常借还；失败后按退避间隔再试
+void SqlConnPool::Maintain_() {
+  std::unique_lock<std::mutex> lock(mtx_);
+  int retryMS = 0;
+  Clock::time_point nextConnect = Clock::now();
+  Clock::time_point nextCheck =
+      Clock::now() + std::chrono::milliseconds(MAINTAIN_MS);
+  Clock::time_point nextReport =
+      Clock::now() + std::chrono::milliseconds(REPORT_MS);
+  while (!isClosed_) {
+    Clock::time_point now = Clock::now();
+    bool want = total_ < minSize_ || (grow_ && total_ < maxSize_);
+    if (want && now >= nextConnect) {
+      grow_ = false;
+      lock.unlock();
+      MYSQL *conn = Connect_();
+      lock.lock();
+      now = Clock::now();
+      if (conn) {
+        retryMS = 0;
+        ++total_;
+        idle_.push_front({conn, now, now});
+        freeCond_.notify_one();
+      } else {
+        retryMS =
+            retryMS ? std::min(retryMS * 2, RETRY_MAX_MS) : RETRY_MIN_MS;
+        nextConnect = now + std::chrono::milliseconds(retryMS);
+      }
+      continue;
+    }
+    if (now >= nextCheck) {
+      CheckIdle_(lock);
+      nextCheck = Clock::now() + std::chrono::milliseconds(MAINTAIN_MS);
+      continue;
+    }
+    if (now >= nextReport) {
+      Stats stats = Snapshot_();
+      LOG_INFO("SqlConnPool total:%d idle:%d inUse:%d acquired:%zu "
+               "timeouts:%zu broken:%zu wait avg/max:%.1f/%.1fms",
+               stats.total, stats.idle, stats.inUse, stats.acquired,
+               stats.timeouts, stats.broken, stats.avgWaitMS,
+               stats.maxWaitMS);
+      nextReport = now + std::chrono::milliseconds(REPORT_MS);
+    }
+    Clock::time_point wake = std::min(nextCheck, nextReport);
+    if (want) {
+      wake = std::min(wake, nextConnect);
+    }
+    maintainCond_.wait_until(lock, wake);
+  }
+}
+
+// 空闲最久的连接关到只剩minSize个；其余太久没确认过的取出来ping，
+// ping期间不会被借出，断开的关闭，缺的连接由Maintain_补建
+void SqlConnPool::CheckIdle_(std::unique_lock<std::mutex> &lock) {
+  Clock::time_point now = Clock::now();
+  std::vector<MYSQL *> closing;
+  while (total_ > minSize_ && !idle_.empty() &&
+         now - idle_.back().since >= std::chrono::milliseconds(IDLE_MS)) {
+    closing.push_back(idle_.back().conn);
+    idle_.pop_back();
+    --total_;
+  }
+  std::vector<Idle> checking;
+  for (auto it = idle_.begin(); it != idle_.end();) {
+    if (now - it->checked >= std::chrono::milliseconds(PING_MS)) {
+      checking.push_back(*it);
+      it = idle_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (closing.empty() && checking.empty()) {
+    return;
+  }
+  lock.unlock();
+  for (MYSQL *conn : closing) {
+    CloseConn_(conn);
+  }
+  int dead = 0;
+  for (Idle &entry : checking) {
+    if (mysql_ping(entry.conn) == 0) {
+      entry.checked = Clock::now();
+      continue;
+    }
+    LOG_WARN("MySql ping error: %s", mysql_error(entry.conn));
+    CloseConn_(entry.conn);
+    entry.conn = nullptr;
+    ++dead;
+  }
+  lock.lock();
+  for (Idle &entry : checking) {
+    if (entry.conn) {
+      idle_.push_back(entry);
+      freeCond_.notify_one();
+    }
+  }
+  total_ -= dead;
+  broken_ += dead;
 }
 
 void SqlConnPool::ClosePool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    isClosed_ = true;
+  }
+  maintainCond_.notify_all();
+  freeCond_.notify_all();
+  if (maintainer_.joinable()) {
+    maintainer_.join();
+  }
   std::lock_guard<std::mutex> lock(mtx_);
-  while (!connQue_.empty()) {
-    auto conn = connQue_.front();
-    connQue_.pop();
-    mysql_close(conn);
+  for (auto &entry : stmtCache_) {
+    CloseStmts_(entry.second);
+  }
+  stmtCache_.clear();
+  for (Idle &entry : idle_) {
+    mysql_close(entry.conn);
   }
+  idle_.clear();
+  total_ = 0;
   mysql_library_end();
 }
 
 int SqlConnPool::GetFreeConnCount() {
   std::lock_guard<std::mutex> lock(mtx_);
-  return connQue_.size();
+  return idle_.size();
+}
+
+void SqlConnPool::RecordWait(int64_t waitUS, bool timedOut) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  RecordWait_(waitUS, timedOut);
+}
+
+void SqlConnPool::RecordWait_(int64_t waitUS, bool timedOut) {
+  ++waits_;
+  waitUS_ += waitUS;
+  maxWaitUS_ = std::max(maxWaitUS_, waitUS);
+  if (timedOut) {
+    ++timeouts_;
+  }
+}
+
+SqlConnPool::Stats SqlConnPool::GetStats() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return Snapshot_();
+}
+
+// 调用方持有mtx_；正在ping的连接算作使用中
+SqlConnPool::Stats SqlConnPool::Snapshot_() const {
+  Stats stats;
+  stats.total = total_;
+  stats.idle = static_cast<int>(idle_.size());
+  stats.inUse = total_ - stats.idle;
+  stats.acquired = acquired_;
+  stats.timeouts = timeouts_;
+  stats.broken = broken_;
+  stats.avgWaitMS = waits_ ? waitUS_ / 1000.0 / waits_ : 0;
+  stats.maxWaitMS = maxWaitUS_ / 1000.0;
+  return stats;
+}
+
+MYSQL_STMT *SqlConnPool::GetStmt(MYSQL *conn, const std::string &sql) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  StmtCache &cache = stmtCache_[conn];
+  if (cache.threadId != mysql_thread_id(conn)) {
+    CloseStmts_(cache);
+    cache.threadId = mysql_thread_id(conn);
+    return nullptr;
+  }
+  auto it = cache.stmts.find(sql);
+  return it == cache.stmts.end() ? nullptr : it->second;
+}
+
+void SqlConnPool::PutStmt(MYSQL *conn, const std::string &sql,
+                          MYSQL_STMT *stmt) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  StmtCache &cache = stmtCache_[conn];
+  MYSQL_STMT *&slot = cache.stmts[sql];
+  if (slot && slot != stmt) {
+    mysql_stmt_close(slot);
+  }
+  slot = stmt;
+}
+
+void SqlConnPool::DropStmt(MYSQL *conn, const std::string &sql) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  StmtCache &cache = stmtCache_[conn];
+  auto it = cache.stmts.find(sql);
+  if (it != cache.stmts.end()) {
+    mysql_stmt_close(it->second);
+    cache.stmts.erase(it);
+  }
+}
+
+// 失效的语句在客户端库里已与连接断开，关闭时只释放本地资源
+void SqlConnPool::CloseStmts_(StmtCache &cache) {
+  for (auto &entry : cache.stmts) {
+    mysql_stmt_close(entry.second);
+  }
+  cache.stmts.clear();
 }
@@ -1,43 +1,125 @@
 #pragma once
 
 #include "../log/log.h"
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <mutex>
+#include <mysql/errmsg.h>
 #include <mysql/mysql.h>
-#include <queue>
-#include <semaphore.h>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+// 连接数在[minSize, maxSize]之间伸缩：借不到连接时由后台线程补建，
+// 空闲太久的关掉直到剩minSize个。后台线程同时定期ping空闲连接，
+// 断开的关闭后重建，数据库不可用期间按退避间隔重试
 class SqlConnPool {
 public:
+  struct Stats {
+    int total; // 已建立的连接
+    int idle;
+    int inUse;
+    size_t acquired;   // 借出次数
+    size_t timeouts;   // 等到期限仍没借到的次数
+    size_t broken;     // 发现断开而关闭的连接数
+    double avgWaitMS;  // 借到连接前的平均等待
+    double maxWaitMS;
+  };
+
   static SqlConnPool *Instance();
 
-  MYSQL *GetConn();
+  // 最多等timeoutMS，负数表示一直等；超时或连接池已关闭返回nullptr
+  MYSQL *GetConn(int timeoutMS = -1);
+  // 不等待，没有空闲连接时返回nullptr，并通知后台线程扩容
+  MYSQL *TryGetConn();
+  // 最近一次操作报连接已断开时直接关闭，不放回池中
   void FreeConn(MYSQL *conn);
   int GetFreeConnCount();
+  // 用TryGetConn自行排队的使用者(SqlAsync)报告等待时间，计入统计
+  void RecordWait(int64_t waitUS, bool timedOut);
+  Stats GetStats();
+
+  // 连接上缓存的预处理语句，按SQL文本查找，只由借到该连接的一方使用。
+  // 连接重连过(thread id变了)时原有语句在服务端已失效，查找时整体丢弃
+  MYSQL_STMT *GetStmt(MYSQL *conn, const std::string &sql);
+  void PutStmt(MYSQL *conn, const std::string &sql, MYSQL_STMT *stmt);
+  void DropStmt(MYSQL *conn, const std::string &sql);
 
+  // 先建好minSize个连接，之后按需增长到maxSize
   void Init(const char *host, uint16_t port, const char *user, const char *pwd,
-            const char *dbName, int connSize);
+            const char *dbName, int minSize, int maxSize);
   void ClosePool();
 
 private:
+  typedef std::chrono::steady_clock Clock;
+
   SqlConnPool() = default;
   ~SqlConnPool() { ClosePool(); }
 
-  int MAX_CONN_;
+  struct StmtCache {
+    unsigned long threadId = 0;
+    std::unordered_map<std::string, MYSQL_STMT *> stmts;
+  };
+  struct Idle {
+    MYSQL *conn;
+    Clock::time_point since;   // 归还时间，用于缩容
+    Clock::time_point checked; // 最近确认可用的时间，用于健康检查
+  };
+
+  MYSQL *Connect_();
+  void CloseConn_(MYSQL *conn);
+  void Maintain_();
+  void CheckIdle_(std::unique_lock<std::mutex> &lock);
+  void RecordWait_(int64_t waitUS, bool timedOut);
+  Stats Snapshot_() const;
+  static bool IsLost_(unsigned int err);
+  static void CloseStmts_(StmtCache &cache);
 
-  std::queue<MYSQL *> connQue_;
+  // 后台线程的检查周期、空闲连接的ping间隔和保留时长
+  static constexpr int MAINTAIN_MS = 1000;
+  static constexpr int PING_MS = 10 * 1000;
+  static constexpr int IDLE_MS = 60 * 1000;
+  // 建连失败后的重试间隔，按倍数退避
+  static constexpr int RETRY_MIN_MS = 500;
+  static constexpr int RETRY_MAX_MS = 8000;
+  // 建连和阻塞读写的超时，避免健康检查卡在失联的连接上
+  static constexpr unsigned int CONNECT_TIMEOUT_S = 3;
+  static constexpr unsigned int IO_TIMEOUT_S = 10;
+  static constexpr int REPORT_MS = 60 * 1000;
+
+  std::string host_, user_, pwd_, dbName_;
+  uint16_t port_ = 0;
+  int minSize_ = 0;
+  int maxSize_ = 0;
+
+  bool isClosed_ = true;
+  int total_ = 0;
+  bool grow_ = false; // 有人没借到连接，需要扩容
+  std::deque<Idle> idle_; // 前端是最近归还的，优先借出，后端的空闲最久
+  std::unordered_map<MYSQL *, StmtCache> stmtCache_;
   std::mutex mtx_;
-  sem_t semId_;
+  std::condition_variable freeCond_;
+  std::condition_variable maintainCond_;
+  std::thread maintainer_;
+
+  size_t acquired_ = 0;
+  size_t timeouts_ = 0;
+  size_t broken_ = 0;
+  size_t waits_ = 0;
+  int64_t waitUS_ = 0;
+  int64_t maxWaitUS_ = 0;
 };
 
 class SqlConnRAII {
 public:
-  SqlConnRAII(MYSQL **sql, SqlConnPool *connpool) {
+  SqlConnRAII(MYSQL **sql, SqlConnPool *connpool, int timeoutMS = -1) {
     assert(connpool);
-    *sql = connpool->GetConn();
+    *sql = connpool->GetConn(timeoutMS);
     sql_ = *sql;
     connpool_ = connpool;
   }
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 定长、只能移动的可调用对象，闭包原地存放在内部缓冲区里，构造和移动都不分配内存。
+// 放不下的闭包在编译期报错；连接事件只捕获一两个指针，远小于容量
+class Task {
+public:
+  static const size_t CAPACITY = 48;
+
+  Task() noexcept : ops_(nullptr) {}
+  Task(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+  template <typename F, typename Fn = typename std::decay<F>::type,
+            typename = typename std::enable_if<
+                !std::is_same<Fn, Task>::value>::type>
+  Task(F &&f) : ops_(&OpsFor<Fn>::ops) {
+    static_assert(sizeof(Fn) <= CAPACITY, "closure too large for Task");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t),
+                  "closure over-aligned for Task");
+    static_assert(std::is_nothrow_move_constructible<Fn>::value,
+                  "closure must be nothrow movable");
+    new (buf_) Fn(std::forward<F>(f));
+  }
+
+  Task(Task &&other) noexcept : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(buf_, other.buf_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      Reset_();
+      ops_ = other.ops_;
+      if (ops_) {
+        ops_->move(buf_, other.buf_);
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  Task &operator=(std::nullptr_t) noexcept {
+    Reset_();
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task() { Reset_(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  void operator()() {
+    assert(ops_);
+    ops_->invoke(buf_);
+  }
+
+private:
+  struct Ops {
+    void (*invoke)(void *);
+    // 把src中的闭包移动构造到dst，并析构src
+    void (*move)(void *dst, void *src);
+    void (*destroy)(void *);
+  };
+
+  template <typename Fn> struct OpsFor {
+    static void Invoke(void *p) { (*static_cast<Fn *>(p))(); }
+    static void Move(void *dst, void *src) {
+      new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+      static_cast<Fn *>(src)->~Fn();
+    }
+    static void Destroy(void *p) { static_cast<Fn *>(p)->~Fn(); }
+    static constexpr Ops ops = {Invoke, Move, Destroy};
+  };
+
+  void Reset_() {
+    if (ops_) {
+      ops_->destroy(buf_);
+      ops_ = nullptr;
+    }
+  }
+
+  const Ops *ops_;
+  alignas(std::max_align_t) unsigned char buf_[CAPACITY];
+};
+
+template <typename Fn> constexpr Task::Ops Task::OpsFor<Fn>::ops;
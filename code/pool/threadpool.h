@@ -16,19 +16,19 @@ public:
   explicit ThreadPool(int threadCount = 16) : pool_(std::make_shared<Pool>()) {
     assert(threadCount > 0);
     for (int i = 0; i < threadCount; ++i) {
-      std::thread([this]() {
-        std::unique_lock<std::mutex> lock(pool_->mtx_);
+      std::thread([pool = pool_]() {
+        std::unique_lock<std::mutex> lock(pool->mtx_);
         while (true) {
-          if (!pool_->tasks.empty()) {
-            auto task = std::move(pool_->tasks.front());
-            pool_->tasks.pop();
+          if (!pool->tasks.empty()) {
+            auto task = std::move(pool->tasks.front());
+            pool->tasks.pop();
             lock.unlock();
             task();
             lock.lock();
-          } else if (pool_->isClosed) {
+          } else if (pool->isClosed) {
             break;
           } else {
-            pool_->cond_.wait(lock);
+            pool->cond_.wait(lock);
           }
         }
       }).detach();
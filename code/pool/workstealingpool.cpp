@@ -0,0 +1,176 @@
+#include "workstealingpool.h"
+
+namespace {
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  std::this_thread::yield();
+#endif
+}
+
+size_t RoundUpPow2(size_t n) {
+  size_t cap = 2;
+  while (cap < n) {
+    cap <<= 1;
+  }
+  return cap;
+}
+
+} // namespace
+
+WorkStealingPool::WorkStealingPool(int threadCount, size_t queueSize)
+    : multiCore_(std::thread::hardware_concurrency() > 1),
+      next_(0), spinning_(0), isClosed_(false) {
+  assert(threadCount > 0);
+  for (int i = 0; i < threadCount; ++i) {
+    workers_.emplace_back(new Worker(RoundUpPow2(queueSize)));
+  }
+  for (int i = 0; i < threadCount; ++i) {
+    threads_.emplace_back(&WorkStealingPool::Run_, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  isClosed_ = true;
+  for (auto &worker : workers_) {
+    std::lock_guard<std::mutex> lock(worker->mtx);
+    worker->sleeping = false;
+    worker->cond.notify_one();
+  }
+  for (std::thread &t : threads_) {
+    t.join();
+  }
+}
+
+void WorkStealingPool::AddTask(Task task) {
+  Push_(next_.fetch_add(1, std::memory_order_relaxed) % workers_.size(),
+        std::move(task));
+}
+
+void WorkStealingPool::AddTask(size_t key, Task task) {
+  Push_(key % workers_.size(), std::move(task));
+}
+
+bool WorkStealingPool::TryAddTask(size_t key, Task &&task) {
+  return TryPush_(key % workers_.size(), std::move(task));
+}
+
+size_t WorkStealingPool::Pending() const {
+  size_t n = 0;
+  for (auto &worker : workers_) {
+    n += worker->tasks.Size();
+  }
+  return n;
+}
+
+size_t WorkStealingPool::Capacity() const {
+  return workers_.size() * workers_[0]->tasks.Capacity();
+}
+
+// 全满时等worker腾出位置
+void WorkStealingPool::Push_(size_t idx, Task &&task) {
+  while (!TryPush_(idx, std::move(task))) {
+    std::this_thread::yield();
+  }
+}
+
+// 目标队列满了依次放到下一个
+bool WorkStealingPool::TryPush_(size_t idx, Task &&task) {
+  size_t n = workers_.size();
+  for (size_t i = 0; i < n; ++i, idx = (idx + 1) % n) {
+    if (workers_[idx]->tasks.TryPush(std::move(task))) {
+      Notify_(idx);
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::Notify_(size_t idx) {
+  size_t n = workers_.size();
+  // 与Run_中置sleeping后的复查配对，保证不会漏掉唤醒
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  Worker &target = *workers_[idx];
+  if (target.sleeping.load(std::memory_order_relaxed)) {
+    Wake_(target);
+    return;
+  }
+  if (spinning_.load(std::memory_order_relaxed) > 0) {
+    return;
+  }
+  for (size_t i = 1; i < n; ++i) {
+    Worker &other = *workers_[(idx + i) % n];
+    if (other.sleeping.load(std::memory_order_relaxed)) {
+      Wake_(other);
+      return;
+    }
+  }
+}
+
+void WorkStealingPool::Wake_(Worker &worker) {
+  std::lock_guard<std::mutex> lock(worker.mtx);
+  if (worker.sleeping) {
+    worker.sleeping = false;
+    worker.cond.notify_one();
+  }
+}
+
+bool WorkStealingPool::Pop_(size_t self, Task *task) {
+  if (workers_[self]->tasks.TryPop(task)) {
+    return true;
+  }
+  size_t n = workers_.size();
+  for (size_t i = 1; i < n; ++i) {
+    if (workers_[(self + i) % n]->tasks.TryPop(task)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WorkStealingPool::Spin_(size_t self, Task *task) {
+  spinning_.fetch_add(1, std::memory_order_relaxed);
+  bool found = false;
+  for (int i = 0; i < SPIN_ROUNDS && !found; ++i) {
+    if (multiCore_) {
+      for (int j = 0; j < 16; ++j) {
+        CpuRelax();
+      }
+    } else {
+      std::this_thread::yield();
+    }
+    found = Pop_(self, task);
+  }
+  spinning_.fetch_sub(1, std::memory_order_relaxed);
+  return found;
+}
+
+void WorkStealingPool::Run_(size_t self) {
+  Worker &me = *workers_[self];
+  Task task;
+  while (true) {
+    if (Pop_(self, &task) || Spin_(self, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    if (isClosed_) {
+      break;
+    }
+    std::unique_lock<std::mutex> lock(me.mtx);
+    me.sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 置sleeping之前放入的任务在这里能看到，之后放入的会唤醒本线程
+    if (Pop_(self, &task)) {
+      me.sleeping = false;
+      lock.unlock();
+      task();
+      task = nullptr;
+      continue;
+    }
+    me.cond.wait(lock, [&] { return !me.sleeping || isClosed_; });
+    me.sleeping = false;
+  }
+}
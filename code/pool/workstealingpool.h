@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mpmcring.h"
+#include "task.h"
+
+// 每个worker一个无锁的本地队列，提交方按轮询或按key(如fd)选队列放入，
+// worker先取自己的队列，空了再依次从其他worker的队列偷任务。
+// 找不到任务时先自旋一小段时间，仍然没有才在自己的条件变量上休眠；
+// 提交时只唤醒目标worker，目标在忙且没有worker在自旋时再唤醒一个休眠的帮忙。
+// 任务是定长的Task，队列预先分配，提交和取出都不分配内存
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(int threadCount = 16, size_t queueSize = 4096);
+  ~WorkStealingPool();
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  // 轮询分配
+  void AddTask(Task task);
+  // 同一key的任务交给同一个worker，保持缓存亲和；该worker忙时可被偷走
+  void AddTask(size_t key, Task task);
+  // 不等待的提交：所有队列都满时返回false，task保持原样由调用方处理
+  bool TryAddTask(size_t key, Task &&task);
+  // 排队中的任务数(近似)和总容量，供调用方做背压
+  size_t Pending() const;
+  size_t Capacity() const;
+  int ThreadCount() const { return static_cast<int>(workers_.size()); }
+
+private:
+  struct alignas(64) Worker {
+    explicit Worker(size_t queueSize) : tasks(queueSize), sleeping(false) {}
+    MpmcRing<Task> tasks;
+    std::atomic<bool> sleeping;
+    std::mutex mtx;
+    std::condition_variable cond;
+  };
+
+  void Push_(size_t idx, Task &&task);
+  bool TryPush_(size_t idx, Task &&task);
+  void Notify_(size_t idx);
+  bool Pop_(size_t self, Task *task);
+  bool Spin_(size_t self, Task *task);
+  void Wake_(Worker &worker);
+  void Run_(size_t self);
+
+  static const int SPIN_ROUNDS = 128;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  bool multiCore_; // 单核上忙等只会占着生产者的时间片，改为让出CPU
+  std::atomic<size_t> next_;
+  std::atomic<int> spinning_;
+  std::atomic<bool> isClosed_;
+};
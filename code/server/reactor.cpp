@@ -0,0 +1,517 @@
+#include "reactor.h"
+
+Reactor::Reactor(int port, uint32_t listenEvent, uint32_t connEvent,
+                 int timeoutMS, bool reusePort, bool useUring,
+                 ConnSlab *users, WorkStealingPool *threadpool,
+                 WorkStealingPool *dbpool)
+    : port_(port), timeoutMS_(timeoutMS), reusePort_(reusePort),
+      isClose_(false), listenFd_(-1), acceptPaused_(false),
+      listenEvent_(listenEvent), connEvent_(connEvent), users_(users),
+      threadpool_(threadpool), dbpool_(dbpool), wakeFd_(-1),
+      timer_(new TimingWheel(
+          std::bind(&Reactor::OnTimeout_, this, std::placeholders::_1))),
+      epoller_(Poller::Create(useUring)) {
+  phaseTimeoutMS_[HttpConn::IDLE] = timeoutMS;
+  phaseTimeoutMS_[HttpConn::HEADER] =
+      timeoutMS < HEADER_TIMEOUT_MS ? timeoutMS : HEADER_TIMEOUT_MS;
+  phaseTimeoutMS_[HttpConn::BODY] = timeoutMS;
+  phaseTimeoutMS_[HttpConn::DRAIN] = timeoutMS;
+  phaseTimeoutMS_[HttpConn::BACKEND] = timeoutMS;
+}
+
+Reactor::~Reactor() {
+  isClose_ = true;
+  if (listenFd_ >= 0) {
+    close(listenFd_);
+  }
+  if (wakeFd_ >= 0) {
+    close(wakeFd_);
+  }
+}
+
+bool Reactor::Init() {
+  wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd_ < 0 || !epoller_->AddFd(wakeFd_, EPOLLIN)) {
+    LOG_ERROR("Create wakeup eventfd error!");
+    isClose_ = true;
+    return false;
+  }
+  if (!InitSocket_()) {
+    isClose_ = true;
+    return false;
+  }
+  return true;
+}
+
+void Reactor::Stop() { isClose_ = true; }
+
+void Reactor::SetPhaseTimeout(HttpConn::Phase phase, int timeoutMS) {
+  assert(phase >= 0 && phase < HttpConn::PHASE_NUM);
+  phaseTimeoutMS_[phase] = timeoutMS;
+}
+
+void Reactor::Loop() {
+  int timeMS = -1;
+  loopThread_ = std::this_thread::get_id();
+  while (!isClose_) {
+    if (timeoutMS_ > 0) {
+      timeMS = timer_->GetNextTick();
+    }
+    if (acceptPaused_) {
+      if (threadpool_->Pending() <= threadpool_->Capacity() / 2) {
+        ResumeAccept_();
+      } else if (timeMS < 0 || timeMS > PAUSE_POLL_MS) {
+        timeMS = PAUSE_POLL_MS;
+      }
+    }
+    int eventCnt = epoller_->Wait(timeMS);
+    for (int i = 0; i < eventCnt; ++i) {
+      int fd = epoller_->GetEventFd(i);
+      uint32_t events = epoller_->GetEvents(i);
+      int res = 0;
+      const char *data = nullptr;
+      if (fd == wakeFd_) {
+        DealClosing_();
+      } else if (epoller_->IsSent(i)) {
+        epoller_->GetResult(i, &res, &data);
+        DealSent_(users_->Get(fd), res);
+      } else if (fd != listenFd_ && (users_->Get(fd)->IsClosing() ||
+                                     users_->Get(fd)->IsSending())) {
+        // 等待关闭的由DealClosing_或DealSent_处理；发送中的不处理读写，
+        // 发完后会重新挂上读
+        continue;
+      } else if (epoller_->GetResult(i, &res, &data)) {
+        // io_uring已经完成的accept/recv
+        if (fd == listenFd_) {
+          DealAccepted_(res);
+        } else {
+          DealRecv_(users_->Get(fd), res, data);
+        }
+      } else if (fd == listenFd_) {
+        DealListen_();
+      } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        CloseConn_(users_->Get(fd));
+      } else if (events & EPOLLIN) {
+        DealRead_(users_->Get(fd));
+      } else if (events & EPOLLOUT) {
+        DealWrite_(users_->Get(fd));
+      } else {
+        LOG_ERROR("Unexpected event");
+      }
+    }
+  }
+}
+
+void Reactor::SendError_(int fd, const char *info) {
+  assert(fd > 0);
+  if (send(fd, info, strlen(info), 0) < 0)
+    LOG_WARN("send error to client:[%d] error!", fd);
+  close(fd);
+}
+
+void Reactor::CloseConn_(HttpConn *client) {
+  assert(client);
+  if (std::this_thread::get_id() != loopThread_) {
+    PostClose_(client);
+    return;
+  }
+  // 内核可能还在读要发送的数据，取消发送，fd和缓冲区等完成事件来了再释放
+  if (client->IsSending()) {
+    client->MarkClosing();
+    epoller_->DelFd(client->GetFd());
+    return;
+  }
+  LOG_INFO("Client:[%d] quit.", client->GetFd());
+  epoller_->DelFd(client->GetFd());
+  if (timeoutMS_ > 0) {
+    timer_->del(client->GetFd());
+  }
+  client->Close();
+}
+
+// 定时器只在本线程访问，工作线程和数据库线程关闭的连接交回本线程关闭：
+// fd关闭前不会被复用，时间轮里不会留下指向别的reactor新连接的节点
+void Reactor::PostClose_(HttpConn *client) {
+  if (!client->MarkClosing()) {
+    return;
+  }
+  epoller_->DelFd(client->GetFd());
+  {
+    std::lock_guard<std::mutex> locker(closeMtx_);
+    closing_.push_back(client);
+  }
+  uint64_t one = 1;
+  if (write(wakeFd_, &one, sizeof(one)) < 0) {
+    LOG_ERROR("wakeup reactor error: %s", strerror(errno));
+  }
+}
+
+void Reactor::DealClosing_() {
+  uint64_t cnt;
+  if (read(wakeFd_, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+    LOG_ERROR("read wakeup eventfd error: %s", strerror(errno));
+  }
+  std::vector<HttpConn *> closing;
+  {
+    std::lock_guard<std::mutex> locker(closeMtx_);
+    closing.swap(closing_);
+  }
+  for (HttpConn *client : closing) {
+    CloseConn_(client);
+  }
+}
+
+// 线程池模式下阶段可能在工作线程里变了而定时器还是旧的，到期时按当前阶段重新核对
+void Reactor::OnTimeout_(int fd) {
+  HttpConn *client = users_->Get(fd);
+  if (client->IsClosed() || client->IsClosing()) {
+    return;
+  }
+  int64_t left = Deadline_(client) - HttpConn::NowMS();
+  if (left > 0) {
+    timer_->add(fd, static_cast<int>(left));
+    return;
+  }
+  // 连接在等数据库查询结果，回调还会用到它，不能在这里关闭，过一个周期再看
+  if (client->GetPhase() == HttpConn::BACKEND) {
+    timer_->add(fd, timeoutMS_);
+    return;
+  }
+  LOG_INFO("Client[%d] timeout in phase %d", fd,
+           static_cast<int>(client->GetPhase()));
+  CloseConn_(client);
+}
+
+void Reactor::AddClient_(int fd, sockaddr_in addr) {
+  assert(fd > 0);
+  HttpConn *client = users_->Get(fd);
+  client->init(fd, addr);
+  if (timeoutMS_ > 0) {
+    timer_->add(fd, phaseTimeoutMS_[HttpConn::HEADER]);
+  }
+  LOG_INFO("Client:[%d] in!", client->GetFd());
+  if (!epoller_->RecvOnce(fd) && !epoller_->AddFd(fd, EPOLLIN | connEvent_)) {
+    LOG_ERROR("Client[%d] register read failed", fd);
+    CloseConn_(client);
+  }
+}
+
+void Reactor::DealListen_() {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  do {
+    int fd = accept4(listenFd_, reinterpret_cast<struct sockaddr *>(&addr),
+                     &len, SOCK_NONBLOCK);
+    if (fd <= 0) {
+      return;
+    } else if (!users_->Contains(fd)) {
+      SendError_(fd, "Server busy!");
+      LOG_WARN("Client is full!");
+      return;
+    }
+    AddClient_(fd, addr);
+  } while (listenEvent_ & EPOLLET);
+}
+
+// io_uring多次accept得到的连接，不带对端地址，用到时再取
+void Reactor::DealAccepted_(int fd) {
+  if (fd <= 0) {
+    LOG_WARN("accept error: %s", strerror(-fd));
+    return;
+  } else if (!users_->Contains(fd)) {
+    SendError_(fd, "Server busy!");
+    LOG_WARN("Client is full!");
+    return;
+  }
+  struct sockaddr_in addr = {};
+  AddClient_(fd, addr);
+}
+
+// 线程池模式下处理结果要等下一个事件才看得到，只能在派发前按上次的阶段设置
+void Reactor::DealRead_(HttpConn *client) {
+  assert(client);
+  if (threadpool_) {
+    ArmDeadline_(client);
+    Dispatch_(client, [this, client] { OnRead_(client); });
+  } else {
+    OnRead_(client);
+    ArmDeadline_(client);
+  }
+}
+
+// 数据已由io_uring收进提供的缓冲区，先在本线程拷进读缓冲区，
+// 缓冲区在下一次Wait时还给内核
+void Reactor::DealRecv_(HttpConn *client, int res, const char *data) {
+  assert(client);
+  int readErrno = 0;
+  ssize_t ret = client->Receive(data, res, &readErrno);
+  if (threadpool_) {
+    ArmDeadline_(client);
+    Dispatch_(client, [this, client, ret, readErrno] {
+      OnReceived_(client, ret, readErrno);
+    });
+  } else {
+    OnReceived_(client, ret, readErrno);
+    ArmDeadline_(client);
+  }
+}
+
+// io_uring发送完成：没发完接着发，发完且保持连接时继续处理后面的请求
+void Reactor::DealSent_(HttpConn *client, int res) {
+  assert(client);
+  int writeErrno = 0;
+  ssize_t ret = client->SendDone(res, &writeErrno);
+  if (client->IsClosing() || (ret < 0 && writeErrno != EAGAIN) ||
+      (client->ToWriteBytes() == 0 && !client->IsKeepAlive())) {
+    CloseConn_(client);
+    return;
+  }
+  if (client->ToWriteBytes() == 0 || Send_(client)) {
+    Onprocess(client);
+  }
+  ArmDeadline_(client);
+}
+
+void Reactor::DealWrite_(HttpConn *client) {
+  assert(client);
+  if (threadpool_) {
+    ArmDeadline_(client);
+    Dispatch_(client, [this, client] { OnWrite_(client); });
+  } else {
+    OnWrite_(client);
+    ArmDeadline_(client);
+  }
+}
+
+// 线程池队列全满时不阻塞reactor：停止accept新连接，这个事件在本线程处理，
+// 积压降到一半以下后在Loop中恢复
+void Reactor::Dispatch_(HttpConn *client, Task &&task) {
+  if (threadpool_->TryAddTask(client->GetFd(), std::move(task))) {
+    return;
+  }
+  PauseAccept_();
+  task();
+}
+
+// 查询排队已满时这个请求回503
+void Reactor::DispatchDb_(HttpConn *client) {
+  if (client->StartDb([this, client] { ResumeDb_(client); })) {
+    return;
+  }
+  LOG_WARN("DB queue full (%zu queries), reject client[%d]",
+           SqlAsync::Instance()->Pending(), client->GetFd());
+  client->RejectDb();
+  Onprocess(client);
+}
+
+// 在SqlAsync的事件线程里调用，生成响应交给dbpool，满了才在本线程处理
+void Reactor::ResumeDb_(HttpConn *client) {
+  if (!dbpool_->TryAddTask(client->GetFd(),
+                           [this, client] { Onprocess(client); })) {
+    Onprocess(client);
+  }
+}
+
+void Reactor::PauseAccept_() {
+  if (acceptPaused_) {
+    return;
+  }
+  acceptPaused_ = true;
+  epoller_->DelFd(listenFd_);
+  LOG_WARN("Thread pool full (%zu tasks), pause accept",
+           threadpool_->Pending());
+}
+
+void Reactor::ResumeAccept_() {
+  acceptPaused_ = false;
+  if (!ArmListen_()) {
+    LOG_ERROR("resume accept failed");
+  }
+  LOG_INFO("Thread pool drained, resume accept");
+}
+
+int64_t Reactor::Deadline_(const HttpConn *client) const {
+  int timeoutMS = phaseTimeoutMS_[client->GetPhase()];
+  if (timeoutMS <= 0) {
+    timeoutMS = timeoutMS_;
+  }
+  return client->PhaseStartMS() + timeoutMS;
+}
+
+// 到期时间只在阶段变化或DRAIN有进展时改变，其余情况时间轮里不移动节点
+void Reactor::ArmDeadline_(HttpConn *client) {
+  assert(client);
+  if (timeoutMS_ <= 0 || client->IsClosed() || client->IsClosing()) {
+    return;
+  }
+  int64_t left = Deadline_(client) - HttpConn::NowMS();
+  timer_->adjust(client->GetFd(), left > 0 ? static_cast<int>(left) : 0);
+}
+
+void Reactor::OnRead_(HttpConn *client) {
+  assert(client);
+  int readErrno = 0;
+  ssize_t ret = client->read(&readErrno);
+  OnReceived_(client, ret, readErrno);
+}
+
+void Reactor::OnReceived_(HttpConn *client, ssize_t ret, int readErrno) {
+  if (ret <= 0 && readErrno != EAGAIN) {
+    CloseConn_(client);
+    return;
+  }
+  Onprocess(client);
+}
+
+void Reactor::OnWrite_(HttpConn *client) {
+  assert(client);
+  if (Send_(client)) {
+    // 读缓冲区里可能还有超出单批上限的流水线请求
+    Onprocess(client);
+  }
+}
+
+// 返回true表示已全部写完且连接保持，否则已提交异步发送、改为等待EPOLLOUT
+// 或已关闭
+bool Reactor::Send_(HttpConn *client) {
+  if (SubmitSend_(client)) {
+    return false;
+  }
+  int writeErrno = 0;
+  ssize_t ret = client->write(&writeErrno);
+  if (client->ToWriteBytes() == 0) {
+    if (client->IsKeepAlive()) {
+      return true;
+    }
+  } else if (ret > 0 || writeErrno == EAGAIN) {
+    WaitWrite_(client);
+    return false;
+  }
+  CloseConn_(client);
+  return false;
+}
+
+// 单线程模式下由本线程交给io_uring发送，与其他连接的请求在下一次Wait时
+// 一起提交，结果在DealSent_里处理；需要sendfile的正文仍然同步发送
+bool Reactor::SubmitSend_(HttpConn *client) {
+  if (threadpool_ || std::this_thread::get_id() != loopThread_) {
+    return false;
+  }
+  const struct msghdr *msg = nullptr;
+  int flags = 0;
+  if (!client->PrepareSend(&msg, &flags) ||
+      !epoller_->SendMsg(client->GetFd(), msg, flags)) {
+    return false;
+  }
+  client->MarkSending();
+  return true;
+}
+
+void Reactor::Onprocess(HttpConn *client) {
+  while (client->process()) {
+    if (threadpool_) {
+      WaitWrite_(client);
+      return;
+    }
+    // 本线程直接尝试发送，写不完再等EPOLLOUT，省一次epoll往返
+    if (!Send_(client)) {
+      return;
+    }
+  }
+  if (client->NeedsDb()) {
+    DispatchDb_(client);
+    return;
+  }
+  WaitRead_(client);
+}
+
+// 挂不上时关闭连接，免得它一直空等到超时
+void Reactor::WaitRead_(HttpConn *client) {
+  int fd = client->GetFd();
+  if (!epoller_->RecvOnce(fd) && !epoller_->ModFd(fd, connEvent_ | EPOLLIN)) {
+    LOG_ERROR("Client[%d] wait read failed", fd);
+    CloseConn_(client);
+  }
+}
+
+void Reactor::WaitWrite_(HttpConn *client) {
+  int fd = client->GetFd();
+  if (!epoller_->ModFd(fd, connEvent_ | EPOLLOUT)) {
+    LOG_ERROR("Client[%d] wait write failed", fd);
+    CloseConn_(client);
+  }
+}
+
+// 内核支持时用io_uring多次accept，新连接直接作为完成事件送来
+bool Reactor::ArmListen_() {
+  return epoller_->AcceptMulti(listenFd_) ||
+         epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN);
+}
+
+bool Reactor::InitSocket_() {
+  int ret;
+  struct sockaddr_in addr;
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port_);
+
+  listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd_ < 0) {
+    LOG_ERROR("Create socket error!");
+    return false;
+  }
+
+  int reuse = 1;
+  ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void *)&reuse,
+                   sizeof(reuse));
+  if (ret == -1) {
+    LOG_ERROR("set socket setsockopt error!");
+    close(listenFd_);
+    listenFd_ = -1;
+    return false;
+  }
+
+  // 每个reactor各自bind同一端口，由内核在监听socket间分发新连接
+  if (reusePort_) {
+    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, (const void *)&reuse,
+                     sizeof(reuse));
+    if (ret == -1) {
+      LOG_ERROR("set socket SO_REUSEPORT error!");
+      close(listenFd_);
+      listenFd_ = -1;
+      return false;
+    }
+  }
+
+  ret =
+      bind(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+  if (ret < 0) {
+    LOG_ERROR("bind error!");
+    close(listenFd_);
+    listenFd_ = -1;
+    return false;
+  }
+
+  ret = listen(listenFd_, SOMAXCONN);
+  if (ret < 0) {
+    LOG_ERROR("listen error!");
+    close(listenFd_);
+    listenFd_ = -1;
+    return false;
+  }
+
+  if (!ArmListen_()) {
+    LOG_ERROR("addFd listen error!");
+    close(listenFd_);
+    listenFd_ = -1;
+    return false;
+  }
+  SetFdNonblock(listenFd_);
+  LOG_INFO("server port:%d", port_);
+  return true;
+}
+
+int Reactor::SetFdNonblock(int fd) {
+  assert(fd > 0);
+  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
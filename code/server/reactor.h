@@ -0,0 +1,102 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../epoller/poller.h"
+#include "../http/connslab.h"
+#include "../http/httpconn.h"
+#include "../log/log.h"
+#include "../pool/sqlasync.h"
+#include "../pool/workstealingpool.h"
+#include "../timer/timingwheel.h"
+
+// 一个事件循环：监听socket + Epoller + 定时器，连接存放在共享的ConnSlab中
+// threadpool 为空时连接的读写都在本线程内完成（one loop per thread）；
+// 需要查数据库的请求无论哪种模式都交给SqlAsync异步查询，结果回来后在dbpool上
+// 生成并发送响应，等待数据库期间不占用事件线程和工作线程
+class Reactor {
+public:
+  Reactor(int port, uint32_t listenEvent, uint32_t connEvent, int timeoutMS,
+          bool reusePort, bool useUring, ConnSlab *users,
+          WorkStealingPool *threadpool, WorkStealingPool *dbpool);
+  ~Reactor();
+
+  bool Init();
+  void Loop();
+  void Stop();
+  // 在Loop之前调用；timeoutMS <= 0时该阶段按全局超时
+  void SetPhaseTimeout(HttpConn::Phase phase, int timeoutMS);
+
+private:
+  bool InitSocket_();
+  void AddClient_(int fd, sockaddr_in addr);
+  void DealListen_();
+  void DealAccepted_(int fd);
+  bool ArmListen_();
+  void Dispatch_(HttpConn *client, Task &&task);
+  void DispatchDb_(HttpConn *client);
+  void ResumeDb_(HttpConn *client);
+  void PauseAccept_();
+  void ResumeAccept_();
+  void DealWrite_(HttpConn *client);
+  void DealRead_(HttpConn *client);
+  void DealRecv_(HttpConn *client, int res, const char *data);
+  void DealSent_(HttpConn *client, int res);
+  void SendError_(int fd, const char *info);
+  void ArmDeadline_(HttpConn *client);
+  int64_t Deadline_(const HttpConn *client) const;
+  void CloseConn_(HttpConn *client);
+  void PostClose_(HttpConn *client);
+  void DealClosing_();
+  void OnTimeout_(int fd);
+  void OnRead_(HttpConn *client);
+  void OnReceived_(HttpConn *client, ssize_t ret, int readErrno);
+  void OnWrite_(HttpConn *client);
+  bool Send_(HttpConn *client);
+  bool SubmitSend_(HttpConn *client);
+  void WaitRead_(HttpConn *client);
+  void WaitWrite_(HttpConn *client);
+  void Onprocess(HttpConn *client);
+
+  static int SetFdNonblock(int fd);
+
+  // 等待请求头的默认上限，慢速发送头部的连接不能无限占用连接槽
+  static const int HEADER_TIMEOUT_MS = 10000;
+  // 暂停accept期间检查线程池积压的间隔
+  static const int PAUSE_POLL_MS = 10;
+
+  int port_;
+  int timeoutMS_;
+  int phaseTimeoutMS_[HttpConn::PHASE_NUM];
+  bool reusePort_;
+  std::atomic<bool> isClose_;
+  int listenFd_;
+  bool acceptPaused_;
+  uint32_t listenEvent_;
+  uint32_t connEvent_;
+  ConnSlab *users_;
+  WorkStealingPool *threadpool_;
+  WorkStealingPool *dbpool_;
+  std::thread::id loopThread_;
+  // 其他线程要关闭的连接，写wakeFd_唤醒本线程处理
+  int wakeFd_;
+  std::mutex closeMtx_;
+  std::vector<HttpConn *> closing_;
+  std::unique_ptr<TimingWheel> timer_;
+  std::unique_ptr<Poller> epoller_;
+};
@@ -2,13 +2,57 @@
 
 WebServer::WebServer(int port, int trigMode, int timeoutMS, int sqlPort,
                      const char *sqlUser, const char *sqlPwd,
-                     const char *dbName, int connPoolNum, int threadNum,
-                     bool openLog, int logLevel, int logQueSize)
+                     const char *dbName, const char *userStore,
+                     int connPoolNum, int threadNum,
+                     int reactorNum, bool useUring, bool useSendfile,
+                     bool openLog, int logLevel, int logQueSize, int logMode)
     : port_(port), timeoutMS_(timeoutMS), isClose_(false),
-      timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)),
-      epoller_(new Epoller()) {
+      users_(new ConnSlab()) {
+  srcDir_ = getcwd(nullptr, 256);
+  assert(srcDir_);
+  strcat(srcDir_, "/resources");
+  HttpConn::userCount = 0;
+  HttpConn::srcDir = srcDir_;
+  HttpResponse::useSendfile = useSendfile;
+  // 对端关闭后继续写会触发SIGPIPE，sendfile无法用MSG_NOSIGNAL屏蔽
+  signal(SIGPIPE, SIG_IGN);
+
+  InitEventMode_(trigMode);
+  if (reactorNum <= 0) {
+    threadpool_.reset(new WorkStealingPool(threadNum, TASK_QUEUE_SIZE));
+  }
+  if (openLog) {
+    Log::Instance()->init(logLevel, "./log",
+                          logMode == Log::BINARY ? ".bin" : ".log", logQueSize,
+                          logMode);
+  }
+  FileCache::Instance()->Init(srcDir_);
+  BlobCache::Instance()->Init(BLOB_BUDGET, BLOB_MAX_FILE);
+  CredCache::Instance()->Init(CRED_CACHE_SIZE, CRED_TTL_MS);
+
+  if (userStore && *userStore) {
+    // 用户表放在本地文件里，不连接MySQL
+    UserStore *store = new UserStore();
+    auth_.reset(store);
+    if (!store->Open(userStore)) {
+      isClose_ = true;
+    }
+  } else {
+    SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd,
+                                  dbName, DB_MIN_CONN, connPoolNum);
+    if (!SqlAsync::Instance()->Init(connPoolNum, DB_PENDING_MAX,
+                                    DB_ACQUIRE_MS)) {
+      isClose_ = true;
+    }
+    auth_.reset(new SqlAuth());
+  }
+  HttpRequest::auth = auth_.get();
+  dbpool_.reset(new WorkStealingPool(DB_THREAD_NUM, DB_QUEUE_SIZE));
+  if (!InitReactors_(reactorNum, useUring)) {
+    isClose_ = true;
+  }
+
   if (openLog) {
-    Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
     if (isClose_) {
       LOG_ERROR("======== Server init error!i ========");
 
@@ -18,30 +62,58 @@ WebServer::WebServer(int port, int trigMode, int timeoutMS, int sqlPort,
       LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                (listenEvent_ & EPOLLET ? "ET" : "LT"),
                (connEvent_ & EPOLLET ? "ET" : "LT"));
-      LOG_INFO("LogSys level:: %d", logLevel);
+      LOG_INFO("Event backend: %s", useUring ? "io_uring(epoll fallback)"
+                                             : "epoll");
+      LOG_INFO("File send: %s, file cache: %s",
+               useSendfile ? "sendfile" : "mmap",
+               FileCache::Instance()->IsEnabled() ? "on" : "off");
+      LOG_INFO("LogSys level:: %d, mode: %s", logLevel,
+               logMode == Log::BINARY     ? "binary"
+               : logMode == Log::DEFERRED ? "deferred"
+                                          : "text");
       LOG_INFO("srcDir: %s", HttpConn::srcDir);
-      LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum,
-               threadNum);
+      LOG_INFO("User store: %s",
+               userStore && *userStore ? userStore : "MySQL");
+      if (!(userStore && *userStore)) {
+        LOG_INFO("DB queries: %s", SqlAsync::NonBlocking()
+                                       ? "non-blocking (MariaDB Connector/C)"
+                                       : "blocking worker threads");
+      }
+      LOG_INFO("Connection slots: %zu", users_->Capacity());
+      if (threadpool_) {
+        LOG_INFO("SqlConnPool max: %d, ThreadPool num: %d", connPoolNum,
+                 threadNum);
+      } else {
+        LOG_INFO("SqlConnPool max: %d, Reactor num: %d", connPoolNum,
+                 reactorNum);
+      }
       LOG_INFO("==============================");
     }
   }
-  srcDir_ = getcwd(nullptr, 256);
-  assert(srcDir_);
-  strcat(srcDir_, "/resources");
-  HttpConn::userCount = 0;
-  HttpConn::srcDir = srcDir_;
-
-  SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName,
-                                connPoolNum);
-  InitEventMode_(trigMode);
-  if (!InitSocket_()) {
-    isClose_ = true;
-  }
 }
 
 WebServer::~WebServer() {
-  close(listenFd_);
   isClose_ = true;
+  // 先停掉数据库查询和工作线程，回调和任务里还会用到reactor
+  SqlAsync::Instance()->Close();
+  dbpool_.reset();
+  threadpool_.reset();
+  reactors_.clear();
+  HttpRequest::auth = nullptr;
+  auth_.reset();
+  LOG_INFO("File cache hit/miss: %zu/%zu, response blob hit/miss: %zu/%zu "
+           "(%zu bytes)",
+           FileCache::Instance()->Hits(), FileCache::Instance()->Misses(),
+           BlobCache::Instance()->Hits(), BlobCache::Instance()->Misses(),
+           BlobCache::Instance()->Bytes());
+  LOG_INFO("Credential cache hit/miss: %zu/%zu", CredCache::Instance()->Hits(),
+           CredCache::Instance()->Misses());
+  SqlConnPool::Stats sql = SqlConnPool::Instance()->GetStats();
+  LOG_INFO("SqlConnPool acquired:%zu timeouts:%zu broken:%zu "
+           "wait avg/max:%.1f/%.1fms",
+           sql.acquired, sql.timeouts, sql.broken, sql.avgWaitMS,
+           sql.maxWaitMS);
+  FileCache::Instance()->Close();
   free(srcDir_);
   SqlConnPool::Instance()->ClosePool();
 }
@@ -70,184 +142,46 @@ void WebServer::InitEventMode_(int trigMode) {
   HttpConn::isET = (connEvent_ & EPOLLET);
 }
 
-void WebServer::Start() {
-  int timeMS = -1;
-  if (!isClose_) {
-    LOG_INFO("======== Server start! ========");
-  }
-  while (!isClose_) {
-    if (timeoutMS_ > 0) {
-      timeMS = timer_->GetNextTick();
-    }
-    int eventCnt = epoller_->Wait(timeMS);
-    for (int i = 0; i < eventCnt; ++i) {
-      int fd = epoller_->GetEventFd(i);
-      uint32_t events = epoller_->GetEventFd(i);
-      if (fd == listenFd_) {
-        DealListen_();
-      } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-        assert(users_.count(fd) > 0);
-        CloseConn_(&users_[fd]);
-      } else if (events & EPOLLIN) {
-        assert(users_.count(fd) > 0);
-        DealRead_(&users_[fd]);
-      } else if (events & EPOLLOUT) {
-        assert(users_.count(fd) > 0);
-        DealWrite_(&users_[fd]);
-      } else {
-        LOG_ERROR("Unexpected event");
-      }
-    }
-  }
-}
-
-void WebServer::SendError_(int fd, const char *info) {
-  assert(fd > 0);
-  if (send(fd, info, strlen(info), 0))
-    LOG_WARN("send error to client:[%d] error!", fd);
-  close(fd);
-}
-
-void WebServer::CloseConn_(HttpConn *client) {
-  assert(client);
-  LOG_INFO("Client:[%d] quit.", client->GetFd());
-  epoller_->DelFd(client->GetFd());
-  client->Close();
-}
-
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
-  assert(fd > 0);
-  users_[fd].init(fd, addr);
-  if (timeoutMS_ > 0) {
-    timer_->add(fd, timeoutMS_,
-                std::bind(&WebServer::CloseConn_, this, &users_[fd]));
-  }
-  epoller_->AddFd(fd, EPOLLIN | connEvent_);
-  SetFdNonblock(fd);
-  LOG_INFO("Client:[%d] in!", users_[fd].GetFd());
-}
-
-void WebServer::DealListen_() {
-  struct sockaddr_in addr;
-  socklen_t len = sizeof(addr);
-  do {
-    int fd =
-        accept(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), &len);
-    if (fd <= 0) {
-      return;
-    } else if (HttpConn::userCount >= MAX_FD) {
-      SendError_(fd, "Server busy!");
-      LOG_WARN("Client is full!");
-      return;
+bool WebServer::InitReactors_(int reactorNum, bool useUring) {
+  if (reactorNum <= 0) {
+    reactors_.emplace_back(new Reactor(port_, listenEvent_, connEvent_,
+                                       timeoutMS_, false, useUring,
+                                       users_.get(), threadpool_.get(),
+                                       dbpool_.get()));
+  } else {
+    for (int i = 0; i < reactorNum; ++i) {
+      reactors_.emplace_back(new Reactor(port_, listenEvent_, connEvent_,
+                                         timeoutMS_, true, useUring,
+                                         users_.get(), nullptr,
+                                         dbpool_.get()));
     }
-    AddClient_(fd, addr);
-  } while (listenEvent_ & EPOLLET);
-}
-void WebServer::DealRead_(HttpConn *client) {
-  assert(client);
-  ExtentTime_(client);
-  threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
-}
-void WebServer::DealWrite_(HttpConn *client) {
-  assert(client);
-  ExtentTime_(client);
-  threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
-}
-
-void WebServer::ExtentTime_(HttpConn *client) {
-  assert(client);
-  if (timeoutMS_ > 0) {
-    timer_->adjust(client->GetFd(), timeoutMS_);
-  }
-}
-
-void WebServer::OnRead_(HttpConn *client) {
-  assert(client);
-  int ret = -1, readErrno = 0;
-  ret = client->read(&readErrno);
-  if (ret <= 0 && readErrno != EAGAIN) {
-    CloseConn_(client);
-    return;
   }
-  Onprocess(client);
-}
-
-void WebServer::OnWrite_(HttpConn *client) {
-  assert(client);
-  int ret = -1, writeErrno = 0;
-  ret = client->write(&writeErrno);
-  if (client->ToWriteBytes() == 0) {
-    if (client->IsKeepAlive()) {
-      epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
-      return;
-    }
-
-  } else if (ret < 0) {
-    if (writeErrno == EAGAIN) {
-      epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-      return;
+  for (auto &reactor : reactors_) {
+    if (!reactor->Init()) {
+      return false;
     }
   }
-  CloseConn_(client);
+  return true;
 }
 
-void WebServer::Onprocess(HttpConn *client) {
-  if (client->process()) {
-    epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-  } else {
-    epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+void WebServer::SetPhaseTimeout(HttpConn::Phase phase, int timeoutMS) {
+  for (auto &reactor : reactors_) {
+    reactor->SetPhaseTimeout(phase, timeoutMS);
   }
 }
 
-bool WebServer::InitSocket_() {
-  int ret;
-  struct sockaddr_in addr;
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  addr.sin_port = htons(port_);
-
-  listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-  if (listenFd_ < 0) {
-    LOG_ERROR("Create socket error!");
-    return false;
-  }
-
-  int reuse = 1;
-  ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void *)&reuse,
-                   sizeof(reuse));
-  if (ret == -1) {
-    LOG_ERROR("set socket setsockopt error!");
-    close(listenFd_);
-    return false;
+void WebServer::Start() {
+  if (isClose_) {
+    return;
   }
-
-  ret =
-      bind(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
-  if (ret < 0) {
-    LOG_ERROR("bind error!");
-    close(listenFd_);
-    return false;
+  LOG_INFO("======== Server start! ========");
+  // 第0个reactor跑在当前线程，其余各占一个线程
+  std::vector<std::thread> loops;
+  for (size_t i = 1; i < reactors_.size(); ++i) {
+    loops.emplace_back(&Reactor::Loop, reactors_[i].get());
   }
-
-  ret = listen(listenFd_, 5);
-  if (ret < 0) {
-    LOG_ERROR("listen error!");
-    close(listenFd_);
-    return false;
+  reactors_[0]->Loop();
+  for (auto &t : loops) {
+    t.join();
   }
-
-  ret = epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN);
-  if (ret == 0) {
-    LOG_ERROR("addFd listen error!");
-    close(listenFd_);
-    return false;
-  }
-  SetFdNonblock(listenFd_);
-  LOG_INFO("server port:%d", port_);
-  return true;
-}
-
-int WebServer::SetFdNonblock(int fd) {
-  assert(fd > 0);
-  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
 }
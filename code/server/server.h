@@ -1,63 +1,77 @@
 #pragma once
 
-#include <arpa/inet.h>
-#include <asm-generic/socket.h>
 #include <cassert>
-#include <cerrno>
 #include <cstdint>
 #include <cstring>
-#include <fcntl.h>
 #include <memory>
-#include <netinet/in.h>
+#include <signal.h>
 #include <sys/epoll.h>
-#include <sys/socket.h>
+#include <thread>
 #include <unistd.h>
-#include <unordered_map>
+#include <vector>
 
-#include "../epoller/epoller.h"
+#include "../auth/sqlauth.h"
+#include "../auth/userstore.h"
+#include "../http/blobcache.h"
+#include "../http/connslab.h"
+#include "../http/credcache.h"
+#include "../http/filecache.h"
 #include "../http/httpconn.h"
 #include "../log/log.h"
+#include "../pool/sqlasync.h"
 #include "../pool/sqlconnpool.h"
-#include "../pool/threadpool.h"
-#include "../timer/timer.h"
+#include "../pool/workstealingpool.h"
+#include "reactor.h"
 
 class WebServer {
 public:
+  // reactorNum == 0: 单reactor + 线程池；
+  // reactorNum > 0: 每个线程一个reactor（SO_REUSEPORT），连接由所属线程独立处理
+  // useUring: 事件后端用io_uring，内核不支持时退回epoll
+  // useSendfile: 文件正文用sendfile从fd直接发送，否则mmap后writev
+  // logMode: Log::MODE，BINARY写到.bin文件，用bin/logdecoder转成文本
   WebServer(int port, int trigMode, int timeoutMS, int sqlPort,
             const char *sqlUser, const char *sqlPwd, const char *dbName,
-            int connPoolNum, int threadNum, bool openLog, int logLevel,
-            int logQueSize);
+            const char *userStore, int connPoolNum, int threadNum, int reactorNum, bool useUring,
+            bool useSendfile, bool openLog, int logLevel, int logQueSize,
+            int logMode);
   ~WebServer();
+  // 分阶段的连接超时，默认空闲/请求体/发送都用timeoutMS，等待请求头最多10秒
+  void SetPhaseTimeout(HttpConn::Phase phase, int timeoutMS);
   void Start();
 
 private:
-  bool InitSocket_();
+  bool InitReactors_(int reactorNum, bool useUring);
   void InitEventMode_(int trigMode);
-  void AddClient_(int fd, sockaddr_in addr);
-  void DealListen_();
-  void DealWrite_(HttpConn *client);
-  void DealRead_(HttpConn *client);
-  void SendError_(int fd, const char *info);
-  void ExtentTime_(HttpConn *client);
-  void CloseConn_(HttpConn *client);
-  void OnRead_(HttpConn *client);
-  void OnWrite_(HttpConn *client);
-  void Onprocess(HttpConn *client);
 
-  static int SetFdNonblock(int fd);
-
-  static const int MAX_FD = 65535;
+  // 小文件完整响应缓存的总内存和文件大小上限
+  static const size_t BLOB_BUDGET = 32 << 20;
+  static const size_t BLOB_MAX_FILE = 64 << 10;
+  // 每个worker的任务队列长度，全满时reactor暂停accept
+  static const size_t TASK_QUEUE_SIZE = 4096;
+  // 排队等数据库连接的查询数上限，超过时登录/注册请求直接回503
+  static const size_t DB_PENDING_MAX = 4096;
+  // 连接池常驻的连接数(上限由构造参数给出)和排队等连接的期限，超时同样回503
+  static const int DB_MIN_CONN = 2;
+  static const int DB_ACQUIRE_MS = 2000;
+  // 查询完成后生成响应的线程数和每个线程的队列长度
+  static const int DB_THREAD_NUM = 2;
+  static const size_t DB_QUEUE_SIZE = 256;
+  // 登录凭证缓存的条目数和摘要有效期
+  static const size_t CRED_CACHE_SIZE = 1 << 16;
+  static const int CRED_TTL_MS = 300 * 1000;
 
   int port_;
   bool openLinger_;
   int timeoutMS_;
   bool isClose_;
-  int listenFd_;
   char *srcDir_;
   uint32_t listenEvent_;
   uint32_t connEvent_;
-  std::unique_ptr<HeapTimer> timer_;
-  std::unique_ptr<ThreadPool> threadpool_;
-  std::unique_ptr<Epoller> epoller_;
-  std::unordered_map<int, HttpConn> users_;
+  std::unique_ptr<ConnSlab> users_;
+  std::unique_ptr<WorkStealingPool> threadpool_;
+  // 数据库查询完成后在这里生成并发送响应，查询本身不占线程
+  std::unique_ptr<WorkStealingPool> dbpool_;
+  std::unique_ptr<AuthBackend> auth_;
+  std::vector<std::unique_ptr<Reactor>> reactors_;
 };
@@ -16,13 +16,11 @@ void HeapTimer::del_(size_t i) {
 
 void HeapTimer::shiftup_(size_t i) {
   assert(i >= 0 && i < heap_.size());
-  size_t parent = (i - 1) / 2;
-  while (parent >= 0) {
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
     if (heap_[parent] > heap_[i]) {
       SwapNode_(i, parent);
       i = parent;
-      parent = (i - 1) / 2;
-
     } else {
       break;
     }
@@ -32,19 +30,19 @@ void HeapTimer::shiftup_(size_t i) {
 bool HeapTimer::shiftdown_(size_t i, size_t n) {
 
   assert(i >= 0 && i < heap_.size());
-  assert(n >= 0 && n < heap_.size());
+  assert(n >= 0 && n <= heap_.size());
   size_t idx = i;
   size_t child = i * 2 + 1;
   while (child < n) {
     if (child + 1 < n && heap_[child + 1] < heap_[child]) {
       ++child;
     }
-    if (heap_[child] < heap_[idx]) {
-      SwapNode_(idx, child);
-      idx = child;
-      child = child * 2 + 1;
+    if (!(heap_[child] < heap_[idx])) {
+      break;
     }
-    break;
+    SwapNode_(idx, child);
+    idx = child;
+    child = child * 2 + 1;
   }
   return idx > i;
 }
@@ -0,0 +1,196 @@
+#include "timingwheel.h"
+
+namespace {
+
+// 把位图循环右移shift位后找最低的非零位，即从shift格开始往后第一个非空格子的距离
+inline int NextSet(uint64_t bits, int shift) {
+  uint64_t r = shift ? (bits >> shift) | (bits << (64 - shift)) : bits;
+  return __builtin_ctzll(r);
+}
+
+} // namespace
+
+TimingWheel::TimingWheel(ExpireCallback onExpire)
+    : onExpire_(std::move(onExpire)), start_(Clock::now()), now_(0),
+      size_(0) {
+  for (int l = 0; l < LEVELS; ++l) {
+    for (int s = 0; s < SLOTS; ++s) {
+      head_[l][s] = -1;
+    }
+    occupied_[l] = 0;
+  }
+}
+
+uint64_t TimingWheel::NowTick_() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                               start_)
+      .count();
+}
+
+void TimingWheel::add(int id, int timeoutMS) {
+  assert(id >= 0 && timeoutMS >= 0);
+  if (static_cast<size_t>(id) >= nodes_.size()) {
+    nodes_.resize(id + 1, Node{0, 0, -1, -1, -1, 0});
+  }
+  if (nodes_[id].level >= 0) {
+    Unlink_(id);
+  } else {
+    ++size_;
+  }
+  uint64_t expire = std::max(NowTick_() + timeoutMS, now_ + 1);
+  nodes_[id].expire = expire;
+  Place_(id, expire);
+}
+
+void TimingWheel::adjust(int id, int timeoutMS) {
+  assert(id >= 0 && timeoutMS >= 0);
+  if (static_cast<size_t>(id) >= nodes_.size() || nodes_[id].level < 0) {
+    return;
+  }
+  Node &node = nodes_[id];
+  uint64_t expire = std::max(NowTick_() + timeoutMS, now_ + 1);
+  node.expire = expire;
+  if (expire < node.due) {
+    Unlink_(id);
+    Place_(id, expire);
+  }
+}
+
+void TimingWheel::del(int id) {
+  if (id < 0 || static_cast<size_t>(id) >= nodes_.size() ||
+      nodes_[id].level < 0) {
+    return;
+  }
+  Unlink_(id);
+  nodes_[id].level = -1;
+  --size_;
+}
+
+void TimingWheel::clear() {
+  for (int l = 0; l < LEVELS; ++l) {
+    for (int s = 0; s < SLOTS; ++s) {
+      head_[l][s] = -1;
+    }
+    occupied_[l] = 0;
+  }
+  for (Node &node : nodes_) {
+    node.level = -1;
+  }
+  size_ = 0;
+}
+
+// 按到期时间与now_的距离选层：距离小于64^(l+1)的放第l层，
+// 格子号取到期tick在该层的位段，该格下沉时正好轮到它
+void TimingWheel::Place_(int id, uint64_t expire) {
+  uint64_t delta = expire - now_;
+  if (delta > MAX_TICKS) {
+    expire = now_ + MAX_TICKS;
+    delta = MAX_TICKS;
+  }
+  int level = 0;
+  while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * SLOT_BITS))) {
+    ++level;
+  }
+  int slot = (expire >> (level * SLOT_BITS)) & (SLOTS - 1);
+  Node &node = nodes_[id];
+  node.due = expire;
+  node.level = level;
+  node.slot = slot;
+  node.prev = -1;
+  node.next = head_[level][slot];
+  if (node.next >= 0) {
+    nodes_[node.next].prev = id;
+  }
+  head_[level][slot] = id;
+  occupied_[level] |= 1ull << slot;
+}
+
+void TimingWheel::Unlink_(int id) {
+  Node &node = nodes_[id];
+  if (node.prev >= 0) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    head_[node.level][node.slot] = node.next;
+    if (node.next < 0) {
+      occupied_[node.level] &= ~(1ull << node.slot);
+    }
+  }
+  if (node.next >= 0) {
+    nodes_[node.next].prev = node.prev;
+  }
+}
+
+void TimingWheel::Cascade_(int level, int slot) {
+  while (head_[level][slot] >= 0) {
+    int id = head_[level][slot];
+    Unlink_(id);
+    Place_(id, nodes_[id].expire);
+  }
+}
+
+void TimingWheel::Expire_(int slot) {
+  // 回调可能增删其他定时器，每次都从格子头部取
+  while (head_[0][slot] >= 0) {
+    int id = head_[0][slot];
+    Unlink_(id);
+    if (nodes_[id].expire > now_) {
+      Place_(id, nodes_[id].expire);
+      continue;
+    }
+    nodes_[id].level = -1;
+    --size_;
+    onExpire_(id);
+  }
+}
+
+// now_之后第一个有事要做的tick：第0层非空格子到期，或上层非空格子下沉
+uint64_t TimingWheel::NextTick_() const {
+  uint64_t next = UINT64_MAX;
+  for (int l = 0; l < LEVELS; ++l) {
+    if (!occupied_[l]) {
+      continue;
+    }
+    int shift = l * SLOT_BITS;
+    uint64_t cur = now_ >> shift;
+    int dist = NextSet(occupied_[l], (cur + 1) & (SLOTS - 1)) + 1;
+    next = std::min(next, (cur + dist) << shift);
+  }
+  return next;
+}
+
+void TimingWheel::Advance_(uint64_t target) {
+  while (now_ < target) {
+    uint64_t next = NextTick_();
+    if (next > target) {
+      now_ = target;
+      return;
+    }
+    // 中间跳过的tick没有非空格子
+    now_ = next;
+    for (int l = 1; l < LEVELS; ++l) {
+      int shift = l * SLOT_BITS;
+      if (now_ & ((1ull << shift) - 1)) {
+        break;
+      }
+      Cascade_(l, (now_ >> shift) & (SLOTS - 1));
+    }
+    Expire_(now_ & (SLOTS - 1));
+  }
+}
+
+int TimingWheel::GetNextTick() {
+  uint64_t now = NowTick_();
+  if (size_ == 0) {
+    now_ = std::max(now_, now);
+    return -1;
+  }
+  Advance_(now);
+  if (size_ == 0) {
+    return -1;
+  }
+  uint64_t next = NextTick_();
+  if (next <= now) {
+    return 0;
+  }
+  return static_cast<int>(std::min<uint64_t>(next - now, INT32_MAX));
+}
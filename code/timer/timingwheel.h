@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// 分层时间轮，按连接槽位(fd)直接索引，增删改都是O(1)。
+// 4层、每层64格，精度1ms，最长约4.6小时，更长的按上限处理。
+// 延后到期时间只改记录不挪格子，等所在格子到期或下沉时再按新时间放置；
+// 提前到期(相差至少一格)才立即移动。
+// 到期时调用构造时给出的回调，参数为id；只能在一个线程内使用
+class TimingWheel {
+public:
+  typedef std::function<void(int)> ExpireCallback;
+
+  explicit TimingWheel(ExpireCallback onExpire);
+  ~TimingWheel() = default;
+
+  void add(int id, int timeoutMS);
+  void adjust(int id, int timeoutMS);
+  void del(int id);
+  void clear();
+  // 处理已到期的定时器，返回到下一次需要处理的毫秒数，没有定时器时返回-1
+  int GetNextTick();
+  size_t size() const { return size_; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Node {
+    uint64_t expire; // 实际到期的tick
+    uint64_t due;    // 放入格子时按的tick，不晚于expire
+    int prev;
+    int next;
+    int8_t level; // -1表示未启用
+    uint8_t slot;
+  };
+
+  uint64_t NowTick_() const;
+  void Place_(int id, uint64_t expire);
+  void Unlink_(int id);
+  void Advance_(uint64_t target);
+  void Cascade_(int level, int slot);
+  void Expire_(int slot);
+  uint64_t NextTick_() const;
+
+  static const int LEVELS = 4;
+  static const int SLOT_BITS = 6;
+  static const int SLOTS = 1 << SLOT_BITS;
+  static const uint64_t MAX_TICKS = (1ull << (LEVELS * SLOT_BITS)) - 1;
+
+  ExpireCallback onExpire_;
+  Clock::time_point start_;
+  uint64_t now_; // 已处理到的tick
+  size_t size_;
+  std::vector<Node> nodes_;
+  int head_[LEVELS][SLOTS];
+  uint64_t occupied_[LEVELS]; // 每层非空格子的位图
+};
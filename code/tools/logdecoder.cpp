@@ -0,0 +1,78 @@
+// 把Log::BINARY模式写出的二进制日志还原成文本，输出到标准输出
+// ../bin/logdecoder log2026_10_18.bin [...]
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "../log/logcodec.h"
+
+namespace {
+
+bool ReadFile(const char *path, std::string *data) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  char buf[1 << 16];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data->append(buf, n);
+  }
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+// 文件可能是多个进程先后追加的，每段以MAGIC开头，调用点编号各自独立
+bool Decode(const char *path) {
+  std::string data;
+  if (!ReadFile(path, &data)) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+  const size_t magic = sizeof(LogCodec::MAGIC);
+  if (data.size() < magic || memcmp(data.data(), LogCodec::MAGIC, magic)) {
+    fprintf(stderr, "%s: not a binary log\n", path);
+    return false;
+  }
+  LogCodec codec;
+  std::string text;
+  size_t off = 0;
+  while (off < data.size()) {
+    if (data.size() - off >= magic &&
+        memcmp(data.data() + off, LogCodec::MAGIC, magic) == 0) {
+      codec.Reset();
+      off += magic;
+      continue;
+    }
+    size_t size = LogCodec::RecordSize(data.data() + off, data.size() - off);
+    if (size == 0) {
+      // 进程崩溃时最后一批可能只写了一部分
+      fprintf(stderr, "%s: truncated record at offset %zu\n", path, off);
+      break;
+    }
+    text.clear();
+    if (codec.Decode(data.data() + off, size, &text)) {
+      fwrite(text.data(), 1, text.size(), stdout);
+    }
+    off += size;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file.bin [...]\n", argv[0]);
+    return 2;
+  }
+  int ret = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (!Decode(argv[i])) {
+      ret = 1;
+    }
+  }
+  return ret;
+}